@@ -3,7 +3,71 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Requests to a block device are queued and carried out one at a
+   time by a dispatch thread for the device, started when the
+   first request is submitted.  The dispatcher picks requests in
+   C-LOOK order: the request with the lowest starting sector at
+   or after the end of the previous transfer, or if there is
+   none, the lowest starting sector overall, so the disk head
+   sweeps across the disk in one direction.  Queued requests that
+   continue the chosen one in the same direction are merged into
+   it, up to MERGE_MAX sectors, so that the driver transfers them
+   all at once.
+
+   So that requests far from the head are not starved, each one
+   also gets a deadline, READ_EXPIRE or WRITE_EXPIRE ticks after
+   it is submitted.  If the oldest request's deadline has passed,
+   it is dispatched next regardless of its sector.
+
+   block_read() and the other synchronous functions submit a
+   request and wait for it to complete.
+
+   Each disk has its own queue and dispatch thread, so requests
+   to disks on different IDE channels are carried out at the
+   same time.  A partition has no queue of its own: requests to
+   it go into its disk's queue, translated to disk sectors, so
+   that they are sorted and merged along with requests to the
+   disk's other partitions. */
+
+/* Maximum number of sectors in a merged transfer. */
+#define MERGE_MAX 128
+
+/* Ticks that a read or write may wait before being dispatched
+   out of order. */
+#define READ_EXPIRE (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (TIMER_FREQ * 5)
+
+/* If true, record each completed request in a trace ring and
+   print the trace and per-device latency histograms at shutdown.
+   Controlled by kernel command-line action "blktrace". */
+bool block_trace;
+
+/* Latency histograms have a bucket for submit-to-complete
+   latencies under 1 us, then bucket N for those from 2**(N-1) us
+   up to 2**N us, and the last bucket for everything longer. */
+#define LATENCY_BUCKETS 24
+
+/* The most recently completed requests, when block_trace is
+   true.  Requests complete on the dispatch threads of every disk
+   at once, so the ring is updated with interrupts off. */
+#define TRACE_CNT 256
+struct trace_entry
+  {
+    struct block *block;        /* Device the request was to. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    bool write;                 /* Write instead of read? */
+    int64_t complete_ns;        /* timer_ns() at completion. */
+    int64_t latency_ns;         /* Submit-to-complete time. */
+  };
+static struct trace_entry trace[TRACE_CNT];
+static unsigned long long trace_cnt;    /* Total # of entries added. */
 
 /* A block device. */
 struct block
@@ -17,8 +81,30 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
+    /* A partition is carried out by its disk, at sector START.
+       For a disk, DISK is the disk itself and START is 0. */
+    struct block *disk;                 /* Disk that owns the queue. */
+    block_sector_t start;               /* First sector on DISK. */
+
+    /* Queue.  Used only by disks. */
+    struct lock queue_lock;             /* Protects queue and stats. */
+    struct condition queue_cond;        /* Signaled on submission. */
+    struct list queue;                  /* Requests, ordered by sector. */
+    struct list fifo;                   /* Requests, oldest first. */
+    block_sector_t next_sector;         /* End of previous transfer. */
+    bool dispatcher_started;            /* Dispatch thread running? */
+
+    /* Statistics, protected by DISK's queue_lock. */
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long cache_hit_cnt;   /* Lookups found in a cache. */
+    unsigned long long cache_miss_cnt;  /* Lookups not found in a cache. */
+    unsigned long long request_cnt;     /* Number of completed requests. */
+    int depth;                          /* Requests now outstanding. */
+    int max_depth;                      /* Maximum of DEPTH. */
+    unsigned long long depth_sum;       /* Sum of DEPTH at submission. */
+    int64_t service_ns;                 /* Sum of submit-to-complete. */
+    unsigned long long latency[LATENCY_BUCKETS]; /* Latency histogram. */
   };
 
 /* List of all block devices. */
@@ -28,6 +114,16 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static struct block *register_block (const char *name, enum block_type,
+                                     const char *extra_info,
+                                     block_sector_t size);
+static void transfer (struct block *, block_sector_t, size_t cnt,
+                      void *const buffers[], bool write);
+static thread_func dispatch;
+static void trace_add (const struct block_request *, int64_t now);
+static void print_queue_stats (struct block *);
+static void print_latency (struct block *);
+static void print_trace (void);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +216,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer (block, sector, 1, &buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +227,286 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer (block, sector, 1, (void *const *) &buffer, true);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK, sector
+   SECTOR + I into BUFFERS[I], which must have room for
+   BLOCK_SECTOR_SIZE bytes.  If BLOCK's driver supports it, the
+   sectors are read with fewer requests to the device than one
+   per sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *const buffers[])
+{
+  transfer (block, sector, cnt, buffers, false);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK, sector
+   SECTOR + I from BUFFERS[I], which must contain
+   BLOCK_SECTOR_SIZE bytes.  If BLOCK's driver supports it, the
+   sectors are written with fewer requests to the device than one
+   per sector.  Returns after the block device has acknowledged
+   receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *const buffers[])
+{
+  transfer (block, sector, cnt, (void *const *) buffers, true);
+}
+
+/* Orders requests by starting sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED) 
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return a->pos < b->pos;
+}
+
+/* Counts a request submitted to BLOCK.  BLOCK's disk's
+   queue_lock must be held. */
+static void
+account_submit (struct block *block) 
+{
+  block->depth++;
+  if (block->depth > block->max_depth)
+    block->max_depth = block->depth;
+  block->depth_sum += block->depth;
+}
+
+/* Counts request R, carried out on BLOCK, as complete at time
+   NOW, in nanoseconds.  BLOCK's disk's queue_lock must be
+   held. */
+static void
+account_complete (struct block *block, const struct block_request *r,
+                  int64_t now) 
+{
+  int64_t us = (now - r->submit_ns) / 1000;
+  int bucket = 0;
+
+  while (us > 0 && bucket < LATENCY_BUCKETS - 1)
+    {
+      us >>= 1;
+      bucket++;
+    }
+  block->latency[bucket]++;
+  block->depth--;
+  block->request_cnt++;
+  block->service_ns += now - r->submit_ns;
+  if (r->write)
+    block->write_cnt += r->cnt;
+  else
+    block->read_cnt += r->cnt;
+}
+
+/* Queues request R to BLOCK and returns without waiting for it
+   to be carried out.  R->complete will be called when it is.
+   Panics if R lies past the end of BLOCK. */
+void
+block_submit (struct block *block, struct block_request *r) 
+{
+  struct block *disk = block->disk;
+
+  ASSERT (r->cnt > 0);
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  r->block = block;
+  r->pos = block->start + r->sector;
+  r->submit_ns = timer_ns ();
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  lock_acquire (&disk->queue_lock);
+  if (!disk->dispatcher_started) 
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "io-%.12s", disk->name);
+      if (thread_create (name, PRI_MAX, dispatch, disk) == TID_ERROR)
+        PANIC ("%s: can't start dispatch thread", disk->name);
+      disk->dispatcher_started = true;
+    }
+  account_submit (disk);
+  if (block != disk)
+    account_submit (block);
+  list_insert_ordered (&disk->queue, &r->elem, request_less, NULL);
+  list_push_back (&disk->fifo, &r->fifo_elem);
+  cond_signal (&disk->queue_cond, &disk->queue_lock);
+  lock_release (&disk->queue_lock);
+}
+
+/* Completion function for transfer(). */
+static void
+transfer_complete (struct block_request *r) 
+{
+  sema_up (r->aux);
+}
+
+/* Transfers the CNT sectors starting at SECTOR between BLOCK and
+   BUFFERS, as block_read_multi() or, if WRITE is true,
+   block_write_multi(), and waits for the transfer to finish. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *const buffers[], bool write) 
+{
+  struct block_request r;
+  struct semaphore done;
+
+  if (cnt == 0)
+    return;
+
+  sema_init (&done, 0);
+  r.sector = sector;
+  r.cnt = cnt;
+  r.write = write;
+  r.buffers = buffers;
+  r.complete = transfer_complete;
+  r.aux = &done;
+  block_submit (block, &r);
+  sema_down (&done);
+}
+
+/* Removes and returns the request that BLOCK should carry out
+   next, which must have at least one queued.  BLOCK's queue_lock
+   must be held. */
+static struct block_request *
+choose_request (struct block *block) 
+{
+  struct block_request *oldest;
+  struct list_elem *e;
+
+  ASSERT (!list_empty (&block->queue));
+
+  oldest = list_entry (list_front (&block->fifo), struct block_request,
+                       fifo_elem);
+  if (timer_ticks () >= oldest->deadline)
+    e = &oldest->elem;
+  else 
+    {
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        if (list_entry (e, struct block_request, elem)->pos
+            >= block->next_sector)
+          break;
+      if (e == list_end (&block->queue))
+        e = list_begin (&block->queue);
+    }
+  return list_entry (e, struct block_request, elem);
+}
+
+/* Carries out the CNT sectors of transfer between disk BLOCK and
+   BUFFERS starting at SECTOR by calling BLOCK's driver. */
+static void
+do_transfer (struct block *block, block_sector_t sector, size_t cnt,
+             void *const buffers[], bool write) 
+{
+  const struct block_operations *ops = block->ops;
+  size_t i;
+
+  if (write) 
+    {
+      if (ops->write_multi != NULL)
+        ops->write_multi (block->aux, sector, cnt,
+                          (const void *const *) buffers);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->write (block->aux, sector + i, buffers[i]);
+    }
+  else 
+    {
+      if (ops->read_multi != NULL)
+        ops->read_multi (block->aux, sector, cnt, buffers);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->read (block->aux, sector + i, buffers[i]);
+    }
+}
+
+/* Dispatch thread for disk BLOCK_.  Carries out queued
+   requests one transfer at a time, merging each request with
+   queued requests for the sectors that follow it. */
+static void
+dispatch (void *block_) 
+{
+  struct block *block = block_;
+
+  for (;;) 
+    {
+      struct block_request *batch[MERGE_MAX];
+      void *buffers[MERGE_MAX];
+      struct block_request *r;
+      block_sector_t sector;
+      size_t batch_cnt, sector_cnt;
+      int64_t now;
+      size_t i;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_cond, &block->queue_lock);
+
+      /* Choose a request and merge its successors into it. */
+      r = choose_request (block);
+      batch[0] = r;
+      batch_cnt = 1;
+      sector = r->pos;
+      sector_cnt = r->cnt;
+      for (;;) 
+        {
+          struct list_elem *next = list_next (&r->elem);
+          list_remove (&r->elem);
+          list_remove (&r->fifo_elem);
+          if (next == list_end (&block->queue))
+            break;
+          r = list_entry (next, struct block_request, elem);
+          if (r->pos != sector + sector_cnt
+              || r->write != batch[0]->write
+              || sector_cnt + r->cnt > MERGE_MAX)
+            break;
+          batch[batch_cnt++] = r;
+          sector_cnt += r->cnt;
+        }
+      block->next_sector = sector + sector_cnt;
+      lock_release (&block->queue_lock);
+
+      /* Transfer. */
+      if (batch_cnt == 1)
+        do_transfer (block, sector, sector_cnt, batch[0]->buffers,
+                     batch[0]->write);
+      else 
+        {
+          size_t ofs = 0;
+          for (i = 0; i < batch_cnt; i++) 
+            {
+              memcpy (buffers + ofs, batch[i]->buffers,
+                      batch[i]->cnt * sizeof *buffers);
+              ofs += batch[i]->cnt;
+            }
+          do_transfer (block, sector, sector_cnt, buffers,
+                       batch[0]->write);
+        }
+
+      /* Complete. */
+      now = timer_ns ();
+      lock_acquire (&block->queue_lock);
+      for (i = 0; i < batch_cnt; i++) 
+        {
+          account_complete (block, batch[i], now);
+          if (batch[i]->block != block)
+            account_complete (batch[i]->block, batch[i], now);
+        }
+      lock_release (&block->queue_lock);
+      if (block_trace)
+        for (i = 0; i < batch_cnt; i++)
+          trace_add (batch[i], now);
+      for (i = 0; i < batch_cnt; i++)
+        batch[i]->complete (batch[i]);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -164,6 +534,7 @@ block_type (struct block *block)
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -171,11 +542,134 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
+          unsigned long long lookups;
+
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          lookups = block->cache_hit_cnt + block->cache_miss_cnt;
+          if (lookups > 0)
+            printf ("%s (%s): %llu cache hits, %llu misses (%llu%% hits)\n",
+                    block->name, block_type_name (block->type),
+                    block->cache_hit_cnt, block->cache_miss_cnt,
+                    block->cache_hit_cnt * 100 / lookups);
+          print_queue_stats (block);
         }
     }
+
+  /* Disks carry out the requests to all of their partitions, so
+     report the queues of disks without roles too. */
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      bool has_role = false;
+
+      for (i = 0; i < BLOCK_ROLE_CNT; i++)
+        if (block_by_role[i] == block)
+          has_role = true;
+      if (block->disk == block && !has_role)
+        print_queue_stats (block);
+    }
+
+  if (block_trace)
+    print_trace ();
+}
+
+/* Prints the average and maximum queue depth and the average
+   service time of requests to BLOCK, if there were any. */
+static void
+print_queue_stats (struct block *block) 
+{
+  unsigned long long depth, service_us;
+
+  if (block->request_cnt == 0)
+    return;
+
+  depth = block->depth_sum * 10 / block->request_cnt;
+  service_us = block->service_ns / 1000 / block->request_cnt;
+  printf ("%s (%s): %llu requests, %llu bytes read, %llu bytes written\n",
+          block->name, block_type_name (block->type), block->request_cnt,
+          block->read_cnt * BLOCK_SECTOR_SIZE,
+          block->write_cnt * BLOCK_SECTOR_SIZE);
+  printf ("%s (%s): queue depth %llu.%llu avg, %d max, "
+          "service time %llu.%03llu ms avg\n",
+          block->name, block_type_name (block->type),
+          depth / 10, depth % 10, block->max_depth,
+          service_us / 1000, service_us % 1000);
+  if (block_trace)
+    print_latency (block);
+}
+
+/* Prints BLOCK's histogram of submit-to-complete latencies. */
+static void
+print_latency (struct block *block) 
+{
+  int b;
+
+  printf ("%s (%s): submit-to-complete latency:\n",
+          block->name, block_type_name (block->type));
+  for (b = 0; b < LATENCY_BUCKETS; b++)
+    if (block->latency[b] != 0)
+      {
+        if (b == 0)
+          printf ("  %10s < %7d us: %llu\n", "", 1, block->latency[b]);
+        else if (b == LATENCY_BUCKETS - 1)
+          printf ("  %10s >= %6d us: %llu\n", "",
+                  1 << (b - 1), block->latency[b]);
+        else
+          printf ("  %7d us .. %7d us: %llu\n",
+                  1 << (b - 1), 1 << b, block->latency[b]);
+      }
+}
+
+/* Adds request R, completed at time NOW in nanoseconds, to the
+   trace ring. */
+static void
+trace_add (const struct block_request *r, int64_t now) 
+{
+  enum intr_level old_level = intr_disable ();
+  struct trace_entry *t = &trace[trace_cnt++ % TRACE_CNT];
+
+  t->block = r->block;
+  t->sector = r->sector;
+  t->cnt = r->cnt;
+  t->write = r->write;
+  t->complete_ns = now;
+  t->latency_ns = now - r->submit_ns;
+  intr_set_level (old_level);
+}
+
+/* Prints the requests in the trace ring, oldest first. */
+static void
+print_trace (void) 
+{
+  unsigned long long first, i;
+
+  first = trace_cnt > TRACE_CNT ? trace_cnt - TRACE_CNT : 0;
+  printf ("Block trace:\n");
+  printf ("  %12s %-8s %2s %10s %5s %10s\n",
+          "time us", "device", "op", "sector", "count", "latency us");
+  if (first > 0)
+    printf ("  (%llu earlier requests not shown)\n", first);
+  for (i = first; i < trace_cnt; i++) 
+    {
+      const struct trace_entry *t = &trace[i % TRACE_CNT];
+      printf ("  %12lld %-8s %2s %10"PRDSNu" %5zu %10lld\n",
+              t->complete_ns / 1000, t->block->name, t->write ? "W" : "R",
+              t->sector, t->cnt, t->latency_ns / 1000);
+    }
+}
+
+/* Records a lookup in a cache of BLOCK's sectors, which was a
+   hit if HIT is true, for reporting by block_print_stats(). */
+void
+block_count_cache_lookup (struct block *block, bool hit)
+{
+  if (hit)
+    block->cache_hit_cnt++;
+  else
+    block->cache_miss_cnt++;
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -187,6 +681,44 @@ struct block *
 block_register (const char *name, enum block_type type,
                 const char *extra_info, block_sector_t size,
                 const struct block_operations *ops, void *aux)
+{
+  struct block *block = register_block (name, type, extra_info, size);
+
+  block->ops = ops;
+  block->aux = aux;
+  block->disk = block;
+  block->start = 0;
+  return block;
+}
+
+/* Registers a new block device with the given NAME, TYPE, SIZE,
+   and EXTRA_INFO, as block_register(), for the partition of DISK
+   that begins at sector START.  Requests to the partition are
+   carried out through DISK's queue. */
+struct block *
+block_register_partition (const char *name, enum block_type type,
+                          const char *extra_info, block_sector_t size,
+                          struct block *disk, block_sector_t start)
+{
+  struct block *block = register_block (name, type, extra_info, size);
+
+  ASSERT (disk->disk == disk);
+  ASSERT (start + size >= start && start + size <= disk->size);
+
+  block->ops = NULL;
+  block->aux = NULL;
+  block->disk = disk;
+  block->start = start;
+  return block;
+}
+
+/* Allocates and initializes a block device with the given NAME,
+   TYPE, and SIZE, adds it to all_blocks, and prints a message
+   about it that includes EXTRA_INFO if it is non-null.  The
+   caller must initialize the driver and disk members. */
+static struct block *
+register_block (const char *name, enum block_type type,
+                const char *extra_info, block_sector_t size)
 {
   struct block *block = malloc (sizeof *block);
   if (block == NULL)
@@ -196,10 +728,22 @@ block_register (const char *name, enum block_type type,
   strlcpy (block->name, name, sizeof block->name);
   block->type = type;
   block->size = size;
-  block->ops = ops;
-  block->aux = aux;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_cond);
+  list_init (&block->queue);
+  list_init (&block->fifo);
+  block->next_sector = 0;
+  block->dispatcher_started = false;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->cache_hit_cnt = 0;
+  block->cache_miss_cnt = 0;
+  block->request_cnt = 0;
+  block->depth = 0;
+  block->max_depth = 0;
+  block->depth_sum = 0;
+  block->service_ns = 0;
+  memset (block->latency, 0, sizeof block->latency);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,22 +55,73 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, size_t cnt,
+                       void *const buffers[]);
+void block_write_multi (struct block *, block_sector_t, size_t cnt,
+                        const void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests.
+
+   A request asks for CNT consecutive sectors starting at SECTOR
+   to be read into or written from BUFFERS, one buffer of
+   BLOCK_SECTOR_SIZE bytes per sector.  block_submit() queues it
+   and returns at once.  When the transfer is done, COMPLETE is
+   called with the request, from the device's dispatch thread.
+   The request and its buffers must stay valid until then. */
+struct block_request;
+typedef void block_complete_func (struct block_request *);
+
+struct block_request
+  {
+    /* Set by the submitter. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    bool write;                         /* Write instead of read? */
+    void *const *buffers;               /* One buffer per sector. */
+    block_complete_func *complete;      /* Called when done. */
+    void *aux;                          /* For use by COMPLETE. */
+
+    /* Owned by the block layer. */
+    struct block *block;                /* Device submitted to. */
+    block_sector_t pos;                 /* First sector on the disk. */
+    struct list_elem elem;              /* Element in sorted queue. */
+    struct list_elem fifo_elem;         /* Element in FIFO queue. */
+    int64_t submit_ns;                  /* timer_ns() when submitted. */
+    int64_t deadline;                   /* Dispatch by this tick. */
+  };
+
+void block_submit (struct block *, struct block_request *);
+
 /* Statistics. */
+extern bool block_trace;
 void block_print_stats (void);
+void block_count_cache_lookup (struct block *, bool hit);
 
 /* Lower-level interface to block device drivers. */
 
+/* Operations on a block device.  READ_MULTI and WRITE_MULTI
+   transfer CNT consecutive sectors, each to or from its own
+   buffer, and may be null if the driver cannot do better than
+   one sector at a time. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multi) (void *aux, block_sector_t, size_t cnt,
+                        void *const buffers[]);
+    void (*write_multi) (void *aux, block_sector_t, size_t cnt,
+                         const void *const buffers[]);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+struct block *block_register_partition (const char *name, enum block_type,
+                                        const char *extra_info,
+                                        block_sector_t size,
+                                        struct block *disk,
+                                        block_sector_t start);
 
 #endif /* devices/block.h */
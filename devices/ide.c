@@ -8,10 +8,22 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the controller is a PCI IDE controller capable of bus
+   mastering, sectors are transferred by DMA: the controller
+   copies them between the disk and memory by itself, following
+   a table of physical memory regions (the "PRD table") that we
+   set up for each transfer, and interrupts when it is done.
+   Meanwhile the thread that asked for the transfer sleeps and
+   the CPU is free for other work.  Otherwise, or if a disk does
+   not support DMA or a transfer fails, sectors are copied by the
+   CPU through the data register ("PIO"). */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +42,24 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prd(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus Master Command Register bits. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+
+/* Bus Master Status Register bits. */
+#define BM_STA_INTR 0x04        /* Interrupt (write 1 to clear). */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +75,27 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Maximum number of sectors transferred by a single command. */
+#define MAX_SECTORS 256
+
+/* A physical region descriptor: an entry in a PRD table, which
+   describes a region of physical memory to transfer by DMA.  A
+   region may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 for 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Number of entries in a PRD table, which takes up a page.  This
+   is enough for MAX_SECTORS sectors that each need two. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +104,7 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool dma;                   /* Transfer sectors by DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -66,6 +114,8 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master base port, 0 if none. */
+    struct prd *prd;            /* PRD table, if bm_base != 0. */
 
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
@@ -81,14 +131,21 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void ide_read_multi (void *, block_sector_t, size_t cnt,
+                            void *const buffers[]);
+static void ide_write_multi (void *, block_sector_t, size_t cnt,
+                             const void *const buffers[]);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *const buffers[], bool write);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +158,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +184,17 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Set up bus mastering.  The channels' bus master
+         registers are 8 ports apart. */
+      c->bm_base = 0;
+      c->prd = NULL;
+      if (bm_base != 0) 
+        {
+          c->prd = palloc_get_page (0);
+          if (c->prd != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +205,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -159,6 +229,70 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* PCI configuration space ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit register at byte offset REG in the PCI
+   configuration space of function FUNC of device DEV on bus 0. */
+static uint32_t
+pci_config_read (int dev, int func, int reg) 
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at byte offset REG in the
+   PCI configuration space of function FUNC of device DEV on bus
+   0. */
+static void
+pci_config_write (int dev, int func, int reg, uint32_t value) 
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that drives the
+   legacy channels and is capable of bus mastering.  If one is
+   found, enables bus mastering and returns the base port of its
+   bus master registers.  Otherwise, returns 0. */
+static uint16_t
+find_bus_master (void) 
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++) 
+      {
+        uint32_t class, bar;
+
+        if ((pci_config_read (dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 1, subclass 1 is an IDE controller.  In the
+           programming interface, bit 7 means that it can bus
+           master, and bits 0 and 2 that a channel is in native
+           mode, at ports other than those we use. */
+        class = pci_config_read (dev, func, 0x08) >> 8;
+        if ((class >> 8) != 0x0101 || (class & 0x80) == 0
+            || (class & 0x05) != 0)
+          continue;
+
+        /* BAR 4 holds the bus master registers' I/O base. */
+        bar = pci_config_read (dev, func, 0x20);
+        if ((bar & 1) == 0 || (bar & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space access and bus mastering.  Writing 0
+           to the upper half leaves the status register alone. */
+        pci_config_write (dev, func, 0x04,
+                          (pci_config_read (dev, func, 0x04) & 0xffff)
+                          | 0x05);
+        return bar & 0xfffc;
+      }
+  return 0;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -284,10 +418,12 @@ identify_ata_device (struct ata_disk *d)
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -344,16 +480,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multi (d_, sec_no, 1, &buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -363,37 +490,110 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    per-disk locking is unneeded. */
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multi (d_, sec_no, 1, &buffer);
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D, sector
+   SEC_NO + I into BUFFERS[I], issuing one command for every
+   MAX_SECTORS sectors.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                void *const buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+
+  while (cnt > 0) 
+    {
+      size_t n = cnt < MAX_SECTORS ? cnt : MAX_SECTORS;
+      size_t i;
+
+      lock_acquire (&c->lock);
+      if (!dma_transfer (d, sec_no, n, buffers, false)) 
+        {
+          select_sector (d, sec_no, n);
+          issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+          for (i = 0; i < n; i++) 
+            {
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              input_sector (c, buffers[i]);
+            }
+        }
+      lock_release (&c->lock);
+
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D, sector
+   SEC_NO + I from BUFFERS[I], issuing one command for every
+   MAX_SECTORS sectors.  Returns after the disk has acknowledged
+   receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                 const void *const buffers[])
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+
+  while (cnt > 0) 
+    {
+      size_t n = cnt < MAX_SECTORS ? cnt : MAX_SECTORS;
+      size_t i;
+
+      lock_acquire (&c->lock);
+      if (!dma_transfer (d, sec_no, n, (void *const *) buffers, true)) 
+        {
+          select_sector (d, sec_no, n);
+          issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+          for (i = 0; i < n; i++) 
+            {
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              output_sector (c, buffers[i]);
+              sema_down (&c->completion_wait);
+            }
+        }
+      lock_release (&c->lock);
+
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors CNT to the disk's
+   sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTORS);
+  ASSERT (sec_no + cnt <= (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);            /* 0 means 256. */
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -429,6 +629,89 @@ output_sector (struct channel *c, const void *sector)
 {
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D
+   and BUFFERS by DMA, in a single command, reading sector
+   SEC_NO + I into BUFFERS[I] if WRITE is false and writing it
+   from there if WRITE is true.  D's channel lock must be held.
+   Returns true if successful.  Returns false without doing
+   anything if D or any of BUFFERS cannot be used for DMA, or if
+   the transfer fails, in which case DMA is disabled for D and
+   the caller should fall back to PIO. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *const buffers[], bool write) 
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  struct prd *p;
+  uint8_t bm_status, status;
+  size_t i;
+
+  /* The controller accesses physical memory, so each buffer must
+     be in the kernel's mapping of it.  Regions must be word
+     aligned. */
+  if (!d->dma)
+    return false;
+  for (i = 0; i < cnt; i++)
+    if (!is_kernel_vaddr (buffers[i]) || (uintptr_t) buffers[i] % 2 != 0)
+      return false;
+
+  /* Describe the buffers in the PRD table.  Regions may not cross
+     64 kB boundaries, so a buffer may need two entries, but
+     buffers that are adjacent in physical memory share one. */
+  p = c->prd;
+  for (i = 0; i < cnt; i++) 
+    {
+      uintptr_t addr = vtop (buffers[i]);
+      uintptr_t end = addr + BLOCK_SECTOR_SIZE;
+
+      while (addr < end) 
+        {
+          uintptr_t next = (addr | 0xffff) + 1;
+          if (next > end)
+            next = end;
+          if (p > c->prd && p[-1].addr + p[-1].size == addr
+              && (p[-1].addr & ~0xffff) == (addr & ~0xffff))
+            p[-1].size += next - addr;
+          else 
+            {
+              ASSERT (p < c->prd + PRD_CNT);
+              p->addr = addr;
+              p->size = next - addr;
+              p->flags = 0;
+              p++;
+            }
+          addr = next;
+        }
+    }
+  p[-1].flags = PRD_EOT;
+
+  /* Program the bus master, issue the command, then start the
+     transfer and wait for the completion interrupt. */
+  outb (reg_bm_command (c), direction);
+  outl (reg_bm_prd (c), vtop (c->prd));
+  outb (reg_bm_status (c), BM_STA_INTR | BM_STA_ERR);
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  /* Stop the bus master and check for errors. */
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BM_STA_INTR | BM_STA_ERR);
+  status = inb (reg_alt_status (c));
+  if ((bm_status & BM_STA_ERR) != 0
+      || (status & (STA_BSY | STA_ERR)) != 0) 
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
 
 /* Low-level ATA primitives. */
 
@@ -4,6 +4,7 @@
 #include "devices/kbd.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
+#include "threads/fpu.h"
 #include "threads/io.h"
 #include "threads/thread.h"
 #ifdef USERPROG
@@ -12,6 +13,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #endif
 
 /* Keyboard control register port. */
@@ -20,6 +22,7 @@
 /* How to shut down when shutdown() is called. */
 static enum shutdown_type how = SHUTDOWN_NONE;
 
+static void power_off (void) NO_RETURN;
 static void print_stats (void);
 
 /* Shuts down the machine in the way configured by
@@ -87,9 +90,6 @@ shutdown_reboot (void)
 void
 shutdown_power_off (void)
 {
-  const char s[] = "Shutdown";
-  const char *p;
-
 #ifdef FILESYS
   filesys_done ();
 #endif
@@ -98,6 +98,26 @@ shutdown_power_off (void)
 
   printf ("Powering off...\n");
   serial_flush ();
+  power_off ();
+}
+
+/* Powers down the machine immediately, without writing back the
+   file system or printing statistics, as if power had been lost.
+   Used to test recovery from crashes. */
+void
+shutdown_crash (void)
+{
+  serial_flush ();
+  power_off ();
+}
+
+/* Powers down the machine we're running on, as long as we're
+   running on Bochs or QEMU. */
+static void
+power_off (void)
+{
+  const char s[] = "Shutdown";
+  const char *p;
 
   /* This is a special power-off sequence supported by Bochs and
      QEMU, but not by physical hardware. */
@@ -127,8 +147,10 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  fpu_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  journal_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -20,26 +20,126 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* If true, stop the periodic timer interrupt while idle.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles per timer tick, as programmed by timer_init(). */
+#define CYCLES_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Longest one-shot countdown the 16-bit PIT counter allows, in
+   whole timer ticks. */
+#define IDLE_TICKS_MAX (UINT16_MAX / CYCLES_PER_TICK)
+
+/* Number of ticks covered by the PIT's one-shot countdown while
+   the system is idle, or 0 if the PIT is in periodic mode. */
+static int64_t idle_countdown_ticks;
+
+/* Nanoseconds per timer tick. */
+#define NS_PER_TICK (1000000000 / TIMER_FREQ)
+
+/* Number of ticks to measure the TSC over in timer_calibrate(). */
+#define TSC_CALIBRATE_TICKS 4
+
+/* TSC clocksource, set up by timer_calibrate().  timer_ns()
+   returns tsc_base_ns plus the time the TSC has counted since it
+   read tsc_base.  Until calibration, tsc_per_tick is 0 and
+   timer_ns() counts whole ticks. */
+#define TSC_SHIFT 24
+static uint64_t tsc_base;       /* TSC value at tsc_base_ns. */
+static int64_t tsc_base_ns;     /* timer_ns() value at tsc_base. */
+static uint32_t tsc_per_tick;   /* TSC cycles per timer tick. */
+static uint64_t tsc_mult;       /* ns per cycle, times 2**TSC_SHIFT. */
+
+/* Pending timer events, in ascending order of expiry time.
+   Events with the same expiry time fire in the order armed. */
+static struct list event_list;
+
+/* Sub-tick countdown.  While a timer event falls between two
+   ticks, the PIT counts down to it in one-shot mode instead of
+   ticking periodically.  split_countdown is the length, in PIT
+   cycles, of the countdown in progress, or 0 if there is none,
+   and split_to_tick is the number of cycles from its start to
+   the next tick. */
+static unsigned split_countdown;
+static unsigned split_to_tick;
+
+/* True while timer_interrupt() is running timer events.  The
+   interrupt handler reprograms the PIT itself afterward. */
+static bool running_events;
+
+/* Delays shorter than this use a busy-wait in real_time_sleep(),
+   because blocking on a timer event would take longer. */
+#define EVENT_SLEEP_MIN_NS 20000
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Hierarchical timing wheel of pending timeouts.
+
+   Level 0 has one slot for each of the next WHEEL_SLOTS ticks,
+   and each slot in level N covers WHEEL_SLOTS times as many
+   ticks as a slot in level N - 1.  A timeout goes into the
+   lowest level whose range reaches its expiry tick.  Each time a
+   level wraps around, the next slot of the level above is
+   emptied and its timeouts are redistributed ("cascaded") into
+   the levels below.  Arming and cancelling a timeout thus take
+   constant time, and so does each tick, on average.
+
+   Timeouts more than WHEEL_RANGE ticks away are parked in the
+   farthest slot and re-placed when it cascades. */
+#define WHEEL_BITS 6                            /* Bits per level. */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)           /* Slots per level. */
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4                          /* Number of levels. */
+#define WHEEL_RANGE ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+static struct list wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+/* Next tick whose level-0 slot the wheel will process. */
+static int64_t wheel_tick;
+
+/* Number of threads blocked in timer_sleep(). */
+static size_t sleep_cnt;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void wheel_insert (struct timeout *);
+static void wheel_cascade (int level, int slot);
+static void wheel_advance (void);
+static int64_t wheel_next_expiry (int64_t limit);
+static void sleep_wake (void *thread_);
+static void idle_countdown_stop (int64_t elapsed);
+static uint64_t read_tsc (void);
+static void tsc_calibrate (void);
+static bool event_less (const struct list_elem *, const struct list_elem *,
+                        void *aux);
+static void run_events (void);
+static void split_update (void);
+static void split_plan (unsigned to_tick, bool periodic);
+static void event_sleep (int64_t ns);
+static void event_sleep_wake (void *sema_);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init (&wheel[level][slot]);
+  list_init (&event_list);
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates loops_per_tick, used to implement brief delays,
+   and the TSC clocksource behind timer_ns(). */
 void
 timer_calibrate (void) 
 {
@@ -64,6 +164,65 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  tsc_calibrate ();
+}
+
+/* Returns true if the CPU has a time-stamp counter. */
+static bool
+tsc_present (void)
+{
+  /* CPUID leaf 1 reports the TSC in bit 4 of EDX.  See [IA32-v2a]
+     "CPUID". */
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & (1 << 4)) != 0;
+}
+
+/* Reads the CPU's time-stamp counter.  See [IA32-v2b] "RDTSC". */
+static uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Measures the TSC against the PIT over TSC_CALIBRATE_TICKS
+   ticks and switches timer_ns() over to it.  Leaves timer_ns()
+   counting whole ticks if the CPU has no usable TSC. */
+static void
+tsc_calibrate (void)
+{
+  enum intr_level old_level;
+  uint64_t start_tsc, cycles;
+  int64_t start;
+
+  if (!tsc_present ())
+    return;
+
+  /* Start measuring right at a timer tick. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  start_tsc = read_tsc ();
+  start = ticks;
+  while (ticks - start < TSC_CALIBRATE_TICKS)
+    barrier ();
+  cycles = read_tsc () - start_tsc;
+  if (cycles / TSC_CALIBRATE_TICKS == 0
+      || cycles / TSC_CALIBRATE_TICKS > UINT32_MAX)
+    return;
+
+  old_level = intr_disable ();
+  tsc_base = read_tsc ();
+  tsc_base_ns = ticks * NS_PER_TICK;
+  tsc_per_tick = cycles / TSC_CALIBRATE_TICKS;
+  tsc_mult = ((uint64_t) NS_PER_TICK << TSC_SHIFT) / tsc_per_tick;
+  intr_set_level (old_level);
+
+  printf ("TSC runs at %'"PRIu64" Hz.\n",
+          (uint64_t) tsc_per_tick * TIMER_FREQ);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -84,16 +243,177 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of nanoseconds since the OS booted.  The
+   value never decreases.  After timer_calibrate(), it is read
+   from the CPU's time-stamp counter, so its resolution is much
+   finer than a tick; before that, or on a CPU with no TSC, it
+   advances a tick at a time. */
+int64_t
+timer_ns (void)
+{
+  uint64_t delta;
+
+  if (tsc_per_tick == 0)
+    return timer_ticks () * NS_PER_TICK;
+
+  /* Convert whole ticks and the remainder separately, so that
+     the multiplication by tsc_mult cannot overflow. */
+  delta = read_tsc () - tsc_base;
+  return (tsc_base_ns + delta / tsc_per_tick * NS_PER_TICK
+          + ((delta % tsc_per_tick * tsc_mult) >> TSC_SHIFT));
+}
+
+/* Initializes timer event E to call FUNC (AUX) when it fires. */
+void
+timer_event_init (struct timer_event *e, timer_event_func *func, void *aux)
+{
+  ASSERT (e != NULL);
+  ASSERT (func != NULL);
+
+  e->func = func;
+  e->aux = aux;
+  e->armed = false;
+}
+
+/* Arms timer event E to fire NS nanoseconds from now, or as
+   soon as possible if NS is not positive.  If E was already
+   armed, it is rearmed for the new time.  E's function is called
+   from the timer interrupt handler, so it must not sleep.
+
+   This function may be called from an interrupt handler. */
+void
+timer_event_arm (struct timer_event *e, int64_t ns)
+{
+  enum intr_level old_level;
+
+  ASSERT (e != NULL);
+
+  old_level = intr_disable ();
+  if (e->armed)
+    list_remove (&e->elem);
+  e->expires = timer_ns () + (ns > 0 ? ns : 0);
+  e->armed = true;
+  list_insert_ordered (&event_list, &e->elem, event_less, NULL);
+  if (list_front (&event_list) == &e->elem)
+    split_update ();
+  intr_set_level (old_level);
+}
+
+/* Disarms timer event E.  Returns true if E was armed, false if
+   it had already fired or was never armed.
+
+   This function may be called from an interrupt handler. */
+bool
+timer_event_cancel (struct timer_event *e)
+{
+  enum intr_level old_level;
+  bool was_armed;
+
+  ASSERT (e != NULL);
+
+  old_level = intr_disable ();
+  was_armed = e->armed;
+  if (was_armed)
+    {
+      list_remove (&e->elem);
+      e->armed = false;
+    }
+  intr_set_level (old_level);
+
+  return was_armed;
+}
+
+/* Initializes timeout TO to call FUNC (AUX) when it fires. */
+void
+timeout_init (struct timeout *to, timeout_func *func, void *aux)
+{
+  ASSERT (to != NULL);
+  ASSERT (func != NULL);
+
+  to->func = func;
+  to->aux = aux;
+  to->armed = false;
+}
+
+/* Arms timeout TO to fire DELAY timer ticks from now, that is,
+   in the timer interrupt that brings timer_ticks() to its
+   current value plus DELAY.  If DELAY is not positive, TO fires
+   on the next tick.  If TO was already armed, it is rearmed for
+   the new time.  TO's function is called from the timer
+   interrupt handler, so it must not sleep.
+
+   This function may be called from an interrupt handler. */
+void
+timeout_arm (struct timeout *to, int64_t delay)
+{
+  enum intr_level old_level;
+
+  ASSERT (to != NULL);
+
+  old_level = intr_disable ();
+  if (to->armed)
+    list_remove (&to->elem);
+  to->expires = ticks + (delay > 0 ? delay : 1);
+  to->armed = true;
+  wheel_insert (to);
+  intr_set_level (old_level);
+}
+
+/* Disarms timeout TO.  Returns true if TO was armed, false if it
+   had already fired or was never armed.
+
+   This function may be called from an interrupt handler. */
+bool
+timeout_cancel (struct timeout *to)
+{
+  enum intr_level old_level;
+  bool was_armed;
+
+  ASSERT (to != NULL);
+
+  old_level = intr_disable ();
+  was_armed = to->armed;
+  if (was_armed)
+    {
+      list_remove (&to->elem);
+      to->armed = false;
+    }
+  intr_set_level (old_level);
+
+  return was_armed;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The running thread is blocked until a timeout wakes it, so it
+   does not occupy the ready list while it waits. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct timeout to;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  timeout_init (&to, sleep_wake, thread_current ());
+  old_level = intr_disable ();
+  timeout_arm (&to, ticks);
+  sleep_cnt++;
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Timeout function for timer_sleep(). */
+static void
+sleep_wake (void *thread_)
+{
+  struct thread *t = thread_;
+
+  sleep_cnt--;
+  thread_unblock (t);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -166,14 +486,374 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Stops the periodic timer interrupt while the system is idle,
+   if tickless idle is enabled.  Called by the idle thread, with
+   interrupts off, just before it halts the CPU; the idle thread
+   runs only when no other thread is ready.
+
+   Instead of a tick every 1/TIMER_FREQ seconds, the PIT is set
+   to raise a single interrupt at the first tick at which a
+   timeout might fire, or as late as its 16-bit counter allows if
+   that is sooner.  If that is less than 2 ticks away, the periodic
+   interrupt is left running because there is nothing to gain. */
+void
+timer_idle_enter (void)
+{
+  int64_t idle_ticks = IDLE_TICKS_MAX;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || idle_countdown_ticks != 0 || split_countdown != 0)
+    return;
+
+  idle_ticks = wheel_next_expiry (idle_ticks);
+  if (!list_empty (&event_list))
+    {
+      struct timer_event *e = list_entry (list_front (&event_list),
+                                          struct timer_event, elem);
+      int64_t event_ticks = (e->expires - timer_ns ()) / NS_PER_TICK;
+      if (event_ticks < idle_ticks)
+        idle_ticks = event_ticks;
+    }
+  if (idle_ticks < 2)
+    return;
+
+  idle_countdown_ticks = idle_ticks;
+  pit_start_countdown (0, idle_ticks * CYCLES_PER_TICK);
+}
+
+/* Restarts the periodic timer interrupt if it was stopped by
+   timer_idle_enter().  Called with interrupts off whenever the
+   idle thread is switched out, because another interrupt, such
+   as a disk completion, made some thread ready before the
+   countdown finished.  The ticks that passed in the meantime are
+   added to the tick count, rounded down so that no timeout comes
+   due without a timer interrupt to fire it.  Timer
+   events also need the PIT reprogrammed when timer_event_arm()
+   is called in an interrupt handler while the system is idle,
+   so it calls this function too.
+
+   If the countdown has already finished, its interrupt is still
+   pending, so the catch-up is left to timer_interrupt(). */
+void
+timer_idle_exit (void)
+{
+  unsigned remaining, elapsed_cycles;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (idle_countdown_ticks == 0)
+    return;
+
+  remaining = pit_read_countdown (0);
+  if (remaining == 0)
+    return;
+
+  elapsed_cycles = idle_countdown_ticks * CYCLES_PER_TICK - remaining;
+  idle_countdown_stop (elapsed_cycles / CYCLES_PER_TICK);
+  split_plan (CYCLES_PER_TICK, true);
+}
+
+/* Puts the PIT back into periodic mode after an idle countdown
+   and advances the tick count by the ELAPSED ticks that passed
+   without a timer interrupt. */
+static void
+idle_countdown_stop (int64_t elapsed)
+{
+  idle_countdown_ticks = 0;
+  pit_configure_channel (0, 2, TIMER_FREQ);
+
+  ticks += elapsed;
+  thread_idle_catch_up (ticks, elapsed);
+  thread_count_avoided_wakeups (sleep_cnt * elapsed);
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
+  bool periodic = true;
+
+  /* If this interrupt ends an idle countdown, catch up on all
+     but the last of the ticks it covered, which is counted here
+     like any other. */
+  if (idle_countdown_ticks != 0)
+    idle_countdown_stop (idle_countdown_ticks - 1);
+  else if (split_countdown != 0)
+    {
+      /* A sub-tick countdown ended.  If the tick has not come
+         yet, it ended at a timer event. */
+      split_to_tick -= split_countdown;
+      split_countdown = 0;
+      if (split_to_tick > 0)
+        {
+          run_events ();
+          split_plan (split_to_tick, false);
+          return;
+        }
+      periodic = false;
+    }
+
   ticks++;
+  wheel_advance ();
+  run_events ();
+  split_plan (CYCLES_PER_TICK, periodic);
   thread_tick ();
 }
 
+/* Calls the function of every timer event whose expiry time has
+   arrived, in order of expiry. */
+static void
+run_events (void)
+{
+  int64_t now;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (list_empty (&event_list))
+    return;
+
+  now = timer_ns ();
+  running_events = true;
+  while (!list_empty (&event_list))
+    {
+      struct timer_event *e = list_entry (list_front (&event_list),
+                                          struct timer_event, elem);
+      if (e->expires > now)
+        break;
+
+      list_pop_front (&event_list);
+      e->armed = false;
+      e->func (e->aux);
+    }
+  running_events = false;
+}
+
+/* Reprograms the PIT after the first pending timer event has
+   changed outside the timer interrupt handler, working out how
+   far away the next tick is from the PIT's current state. */
+static void
+split_update (void)
+{
+  unsigned to_tick;
+  bool periodic;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (running_events)
+    return;
+
+  if (idle_countdown_ticks != 0)
+    {
+      /* This restarts periodic ticks and calls split_plan(),
+         unless the countdown's interrupt is already pending. */
+      timer_idle_exit ();
+      return;
+    }
+  else if (split_countdown != 0)
+    {
+      unsigned remaining = pit_read_countdown (0);
+      if (remaining == 0)
+        {
+          /* The countdown's interrupt is pending, and the handler
+             will reprogram the PIT. */
+          return;
+        }
+      to_tick = split_to_tick - (split_countdown - remaining);
+      split_countdown = 0;
+      periodic = false;
+    }
+  else
+    {
+      to_tick = pit_read_count (0);
+      periodic = true;
+    }
+  split_plan (to_tick, periodic);
+}
+
+/* Programs the PIT for the TO_TICK PIT cycles left before the
+   next tick.  If the first timer event falls before the tick,
+   counts down to the event.  Otherwise, counts down to the tick,
+   unless PERIODIC is true, meaning that the PIT is already in
+   periodic mode with TO_TICK cycles left in the period, or the
+   tick is a full period away, in which case periodic mode is
+   restored. */
+static void
+split_plan (unsigned to_tick, bool periodic)
+{
+  unsigned cycles = to_tick;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (to_tick > 0 && to_tick <= CYCLES_PER_TICK);
+
+  if (!list_empty (&event_list))
+    {
+      struct timer_event *e = list_entry (list_front (&event_list),
+                                          struct timer_event, elem);
+      int64_t ns = e->expires - timer_ns ();
+
+      if (ns <= 0)
+        cycles = 1;
+      else if (ns < (int64_t) to_tick * NS_PER_TICK / CYCLES_PER_TICK)
+        cycles = DIV_ROUND_UP (ns * PIT_HZ, 1000000000);
+      if (cycles == 0)
+        cycles = 1;
+      else if (cycles > to_tick)
+        cycles = to_tick;
+    }
+
+  if (cycles == to_tick && (periodic || to_tick == CYCLES_PER_TICK))
+    {
+      if (!periodic)
+        pit_configure_channel (0, 2, TIMER_FREQ);
+      return;
+    }
+
+  split_to_tick = to_tick;
+  split_countdown = cycles;
+  pit_start_countdown (0, cycles);
+}
+
+/* Returns true if timer event A expires before timer event B,
+   false otherwise. */
+static bool
+event_less (const struct list_elem *a_, const struct list_elem *b_,
+            void *aux UNUSED)
+{
+  const struct timer_event *a = list_entry (a_, struct timer_event, elem);
+  const struct timer_event *b = list_entry (b_, struct timer_event, elem);
+
+  return a->expires < b->expires;
+}
+
+/* Puts armed timeout TO into the wheel slot for its expiry tick,
+   relative to wheel_tick. */
+static void
+wheel_insert (struct timeout *to)
+{
+  int64_t expires = to->expires;
+  int64_t delta = expires - wheel_tick;
+  int level;
+
+  if (delta < 0)
+    {
+      /* Overdue, which happens when a timeout is armed from a
+         timeout function.  Fire it with the next tick. */
+      expires = wheel_tick;
+      delta = 0;
+    }
+  else if (delta >= WHEEL_RANGE)
+    {
+      expires = wheel_tick + WHEEL_RANGE - 1;
+      delta = WHEEL_RANGE - 1;
+    }
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & WHEEL_MASK],
+                  &to->elem);
+}
+
+/* Empties SLOT of wheel LEVEL, redistributing its timeouts into
+   lower levels. */
+static void
+wheel_cascade (int level, int slot)
+{
+  struct list *bucket = &wheel[level][slot];
+  struct list moving;
+
+  list_init (&moving);
+  if (!list_empty (bucket))
+    list_splice (list_end (&moving), list_begin (bucket), list_end (bucket));
+  while (!list_empty (&moving))
+    wheel_insert (list_entry (list_pop_front (&moving),
+                              struct timeout, elem));
+}
+
+/* Fires every timeout whose expiry tick has arrived.  Normally
+   this processes a single tick, but after an idle countdown it
+   catches up on every tick the countdown covered.  Every thread
+   still asleep afterward is a wakeup that yielding in a loop in
+   timer_sleep() would have cost, so it is credited to the
+   scheduler statistics.  If a woken thread outranks the
+   interrupted one, it runs as soon as the interrupt returns. */
+static void
+wheel_advance (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (wheel_tick <= ticks)
+    {
+      struct list *bucket = &wheel[0][wheel_tick & WHEEL_MASK];
+      struct list due;
+      int64_t now;
+      int level;
+
+      /* When level 0 wraps around, refill it from the next slot
+         of level 1, and so on up while each level wraps too. */
+      if ((wheel_tick & WHEEL_MASK) == 0)
+        for (level = 1; level < WHEEL_LEVELS; level++)
+          {
+            int slot = (wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+            wheel_cascade (level, slot);
+            if (slot != 0)
+              break;
+          }
+
+      /* Take this tick's timeouts off the wheel before calling
+         any of them, since a timeout function may arm another
+         timeout into the same slot. */
+      list_init (&due);
+      if (!list_empty (bucket))
+        list_splice (list_end (&due), list_begin (bucket), list_end (bucket));
+      now = wheel_tick++;
+
+      while (!list_empty (&due))
+        {
+          struct timeout *to = list_entry (list_pop_front (&due),
+                                           struct timeout, elem);
+          if (to->expires > now)
+            {
+              /* Parked beyond WHEEL_RANGE. */
+              wheel_insert (to);
+              continue;
+            }
+          to->armed = false;
+          to->func (to->aux);
+        }
+    }
+
+  thread_count_avoided_wakeups (sleep_cnt);
+  thread_yield_to_higher ();
+}
+
+/* Returns the number of ticks from now to the first tick at
+   which the wheel might fire a timeout, or LIMIT if that is
+   further away.  A tick at which level 0 wraps around counts,
+   because timeouts cascading into level 0 might be due then. */
+static int64_t
+wheel_next_expiry (int64_t limit)
+{
+  int64_t delta;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Ticks that the wheel has not processed yet. */
+  if (wheel_tick <= ticks)
+    return 1;
+
+  for (delta = 1; delta < limit; delta++)
+    {
+      int64_t tick = ticks + delta;
+      if ((tick & WHEEL_MASK) == 0
+          || !list_empty (&wheel[0][tick & WHEEL_MASK]))
+        return delta;
+    }
+  return limit;
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
@@ -229,12 +909,39 @@ real_time_sleep (int64_t num, int32_t denom)
     }
   else 
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
-      real_time_delay (num, denom); 
+      /* Otherwise, block on a timer event for more accurate
+         sub-tick timing, or busy-wait if the delay is too short
+         for that to pay off or timer_ns() cannot resolve it. */
+      int64_t ns = num * 1000000000 / denom;
+      if (tsc_per_tick != 0 && ns >= EVENT_SLEEP_MIN_NS)
+        event_sleep (ns);
+      else
+        real_time_delay (num, denom); 
     }
 }
 
+/* Blocks the running thread for NS nanoseconds on a timer
+   event. */
+static void
+event_sleep (int64_t ns)
+{
+  struct semaphore sema;
+  struct timer_event e;
+
+  sema_init (&sema, 0);
+  timer_event_init (&e, event_sleep_wake, &sema);
+  timer_event_arm (&e, ns);
+  sema_down (&sema);
+}
+
+/* Timer event function for event_sleep(). */
+static void
+event_sleep_wake (void *sema_)
+{
+  struct semaphore *sema = sema_;
+  sema_up (sema);
+}
+
 /* Busy-wait for approximately NUM/DENOM seconds. */
 static void
 real_time_delay (int64_t num, int32_t denom)
@@ -1,17 +1,24 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* If true, stop the periodic timer interrupt while idle.
+   Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_ns (void);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
@@ -26,4 +33,45 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* A one-shot timeout, which calls a function from the timer
+   interrupt handler at a given timer tick.  Timeouts are kept
+   in a hierarchical timing wheel, so they are cheap to arm and
+   cancel in large numbers. */
+typedef void timeout_func (void *aux);
+struct timeout
+  {
+    int64_t expires;            /* Tick to fire at. */
+    timeout_func *func;         /* Function to call. */
+    void *aux;                  /* Argument to FUNC. */
+    bool armed;                 /* Waiting to fire? */
+    struct list_elem elem;      /* Element in a wheel slot. */
+  };
+
+void timeout_init (struct timeout *, timeout_func *, void *aux);
+void timeout_arm (struct timeout *, int64_t delay);
+bool timeout_cancel (struct timeout *);
+
+/* A one-shot timer event, which calls a function from the timer
+   interrupt handler once timer_ns() reaches a given time.  Its
+   resolution is finer than a timer tick: when an event falls
+   between two ticks, the PIT is programmed to interrupt at the
+   event itself. */
+typedef void timer_event_func (void *aux);
+struct timer_event
+  {
+    int64_t expires;            /* timer_ns() value to fire at. */
+    timer_event_func *func;     /* Function to call. */
+    void *aux;                  /* Argument to FUNC. */
+    bool armed;                 /* Waiting to fire? */
+    struct list_elem elem;      /* Element in event_list. */
+  };
+
+void timer_event_init (struct timer_event *, timer_event_func *, void *aux);
+void timer_event_arm (struct timer_event *, int64_t ns);
+bool timer_event_cancel (struct timer_event *);
+
+/* Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 #endif /* devices/timer.h */
@@ -0,0 +1,542 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Buffer cache for sectors of the file system device.
+
+   The cache holds CACHE_SIZE sectors.  Writes only modify the
+   cached copy and mark it dirty; dirty sectors reach the disk
+   when they are evicted, when the write-behind thread runs, or
+   when cache_flush() is called.  Victims are chosen by the
+   clock (second chance) algorithm.
+
+   Synchronization: cache_lock protects the mapping from sectors
+   to entries and each entry's bookkeeping.  An entry's data is
+   protected by its own lock, which is held while the data is
+   being read from or written to disk, so that disk I/O never
+   happens with cache_lock held.  A pinned entry (one with a
+   nonzero pin_cnt) is in use and may not be evicted.
+
+   Metadata is written with cache_write_meta(), which adds the
+   sector to the running journal transaction.  Such a "logged"
+   sector is not written back or evicted until the transaction
+   commits, because its new contents must reach the journal
+   before they reach their home location.  The journal then
+   writes it home itself and releases it with cache_unlog().
+
+   cache_read_ahead() queues sectors to be loaded in the
+   background by the read-ahead thread, so that a reader
+   streaming through a file finds the next sectors already
+   cached.
+
+   cache_flush() and the read-ahead thread transfer runs of
+   consecutive sectors with a single block_write_multi() or
+   block_read_multi() call, which the disk can carry out with a
+   single command. */
+
+/* Time between runs of the write-behind thread, in timer ticks. */
+#define WRITE_BEHIND_TICKS TIMER_FREQ
+
+/* Maximum number of queued read-ahead requests.  Further
+   requests are dropped until the read-ahead thread catches up. */
+#define READ_AHEAD_MAX 32
+
+/* Maximum number of sectors the read-ahead thread loads at
+   once. */
+#define READ_AHEAD_RUN 8
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;      /* Cached sector, if in_use. */
+    bool in_use;                /* Does this entry hold a sector? */
+    bool dirty;                 /* Modified since last written? */
+    bool logged;                /* In the running transaction? */
+    bool accessed;              /* Used since the clock hand passed? */
+    int pin_cnt;                /* Number of users; evictable if 0. */
+    struct lock lock;           /* Protects data. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes of data. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static size_t clock_hand;
+
+/* Queue of sectors to read ahead, a ring buffer. */
+static block_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head;  /* Index of oldest request. */
+static size_t read_ahead_cnt;   /* Number of queued requests. */
+static struct lock read_ahead_lock;
+static struct condition read_ahead_cond;
+
+static void write_at (block_sector_t, const void *, size_t ofs, size_t size,
+                      bool meta);
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static struct cache_entry *cache_pin (block_sector_t, bool *hit);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_evict (void);
+static void cache_flush_entry (struct cache_entry *);
+static void flush_run (struct cache_entry *[], size_t cnt);
+static void load_run (struct cache_entry *[], size_t cnt);
+static thread_func write_behind;
+static thread_func read_ahead;
+
+/* Initializes the buffer cache and starts the write-behind and
+   read-ahead threads. */
+void
+cache_init (void) 
+{
+  uint8_t *data;
+  size_t i;
+
+  data = palloc_get_multiple (PAL_ASSERT,
+                              CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE);
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++) 
+    {
+      struct cache_entry *e = &cache[i];
+      e->in_use = false;
+      e->pin_cnt = 0;
+      lock_init (&e->lock);
+      e->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_cond);
+
+  thread_create ("write-behind", PRI_DEFAULT, write_behind, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead, NULL);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer) 
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR
+   into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size) 
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer) 
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   offset OFS within the sector. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size) 
+{
+  write_at (sector, buffer, ofs, size, false);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes of metadata from BUFFER into
+   SECTOR, as part of the current journal operation. */
+void
+cache_write_meta (block_sector_t sector, const void *buffer) 
+{
+  cache_write_meta_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes of metadata from BUFFER into SECTOR,
+   starting at byte offset OFS within the sector, as part of the
+   current journal operation. */
+void
+cache_write_meta_at (block_sector_t sector, const void *buffer,
+                     size_t ofs, size_t size) 
+{
+  write_at (sector, buffer, ofs, size, true);
+}
+
+/* Marks SECTOR, which the journal has just written to its home
+   location, as clean and no longer part of a transaction. */
+void
+cache_unlog (block_sector_t sector) 
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  ASSERT (e != NULL && e->logged);
+  e->logged = false;
+  e->dirty = false;
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty cached sector to disk, except for those in
+   the running journal transaction. */
+void
+cache_flush (void) 
+{
+  struct cache_entry *dirty[CACHE_SIZE];
+  struct cache_entry *run[CACHE_SIZE];
+  size_t dirty_cnt = 0;
+  size_t run_cnt = 0;
+  size_t i;
+
+  /* Pin the dirty entries, sorted by sector. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++) 
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->in_use && e->dirty && !e->logged) 
+        {
+          size_t j;
+
+          e->pin_cnt++;
+          for (j = dirty_cnt++; j > 0 && dirty[j - 1]->sector > e->sector;
+               j--)
+            dirty[j] = dirty[j - 1];
+          dirty[j] = e;
+        }
+    }
+  lock_release (&cache_lock);
+
+  /* Write them back in runs of consecutive sectors.  Entry locks
+     are taken in order of sector, so holding several at once
+     cannot deadlock. */
+  for (i = 0; i < dirty_cnt; i++) 
+    {
+      struct cache_entry *e = dirty[i];
+
+      lock_acquire (&e->lock);
+      if (!e->dirty || e->logged) 
+        {
+          /* Written back or logged since we looked. */
+          cache_put (e);
+          continue;
+        }
+      if (run_cnt > 0 && run[run_cnt - 1]->sector + 1 != e->sector) 
+        {
+          flush_run (run, run_cnt);
+          run_cnt = 0;
+        }
+      run[run_cnt++] = e;
+    }
+  if (run_cnt > 0)
+    flush_run (run, run_cnt);
+}
+
+/* Queues SECTOR to be read into the cache in the background,
+   unless too many requests are already pending. */
+void
+cache_read_ahead (block_sector_t sector) 
+{
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_MAX) 
+    {
+      read_ahead_queue[(read_ahead_head + read_ahead_cnt++)
+                       % READ_AHEAD_MAX] = sector;
+      cond_signal (&read_ahead_cond, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   offset OFS within the sector.  If META is true, the sector
+   joins the running journal transaction. */
+static void
+write_at (block_sector_t sector, const void *buffer,
+          size_t ofs, size_t size, bool meta) 
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* There is no need to read a sector that will be entirely
+     overwritten. */
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  if (meta && !e->logged) 
+    {
+      e->logged = true;
+      journal_add (sector);
+    }
+  cache_put (e);
+}
+
+/* Returns the cache entry for SECTOR, pinned and with its lock
+   held, loading it into the cache first if necessary.  If LOAD
+   is false and SECTOR is not already cached, its contents are
+   left uninitialized instead of being read from disk, because
+   the caller is about to overwrite all of them. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load) 
+{
+  struct cache_entry *e;
+  bool hit;
+
+  e = cache_pin (sector, &hit);
+  block_count_cache_lookup (fs_device, hit);
+  if (!hit && load)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Returns the cache entry for SECTOR, pinned and with its lock
+   held.  If SECTOR was already cached, sets *HIT to true.
+   Otherwise, assigns SECTOR an entry whose contents the caller
+   must fill in, and sets *HIT to false. */
+static struct cache_entry *
+cache_pin (block_sector_t sector, bool *hit) 
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;) 
+    {
+      e = cache_lookup (sector);
+      if (e != NULL) 
+        {
+          e->pin_cnt++;
+          e->accessed = true;
+          lock_release (&cache_lock);
+
+          /* If another thread is still reading the sector from
+             disk, this waits for it to finish. */
+          lock_acquire (&e->lock);
+          *hit = true;
+          return e;
+        }
+
+      /* cache_evict() may release cache_lock, so another thread
+         may have cached SECTOR in the meantime. */
+      e = cache_evict ();
+      if (cache_lookup (sector) == NULL)
+        break;
+    }
+
+  /* An unpinned entry's lock is free, so taking it here cannot
+     block while we hold cache_lock. */
+  e->sector = sector;
+  e->in_use = true;
+  e->dirty = false;
+  e->logged = false;
+  e->accessed = true;
+  e->pin_cnt = 1;
+  lock_acquire (&e->lock);
+  lock_release (&cache_lock);
+  *hit = false;
+  return e;
+}
+
+/* Releases entry E, obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e) 
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Returns the cache entry for SECTOR, or a null pointer if
+   SECTOR is not cached.  Must be called with cache_lock held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector) 
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an unpinned, clean cache entry to reuse, writing dirty
+   entries back to disk as the clock hand passes them.  Must be
+   called with cache_lock held, which may be released and
+   reacquired while writing.  Waits for an entry to be unpinned
+   if all of them are in use.  Logged entries count as pinned. */
+static struct cache_entry *
+cache_evict (void) 
+{
+  size_t pinned_cnt = 0;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;) 
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (!e->in_use)
+        return e;
+      if (e->pin_cnt > 0 || e->logged) 
+        {
+          if (++pinned_cnt >= CACHE_SIZE) 
+            {
+              /* Every entry is pinned.  Let their users finish. */
+              lock_release (&cache_lock);
+              thread_yield ();
+              lock_acquire (&cache_lock);
+              pinned_cnt = 0;
+            }
+          continue;
+        }
+      pinned_cnt = 0;
+      if (e->accessed) 
+        {
+          e->accessed = false;
+          continue;
+        }
+      if (!e->dirty)
+        return e;
+
+      /* Write the dirty entry back and give it another chance to
+         be picked on a later pass, in case it was pinned again
+         in the meantime. */
+      lock_release (&cache_lock);
+      cache_flush_entry (e);
+      lock_acquire (&cache_lock);
+    }
+}
+
+/* Writes cache entry E to disk if it is dirty, unless it is
+   logged.  Must be called without cache_lock held. */
+static void
+cache_flush_entry (struct cache_entry *e) 
+{
+  lock_acquire (&cache_lock);
+  if (!e->in_use || !e->dirty || e->logged) 
+    {
+      lock_release (&cache_lock);
+      return;
+    }
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (e->dirty && !e->logged) 
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+    }
+  cache_put (e);
+}
+
+/* Writes the CNT pinned, locked entries in RUN, which hold
+   consecutive sectors, to disk and releases them. */
+static void
+flush_run (struct cache_entry *run[], size_t cnt) 
+{
+  const void *buffers[CACHE_SIZE];
+  size_t i;
+
+  ASSERT (cnt > 0);
+  for (i = 0; i < cnt; i++)
+    buffers[i] = run[i]->data;
+  block_write_multi (fs_device, run[0]->sector, cnt, buffers);
+  for (i = 0; i < cnt; i++) 
+    {
+      run[i]->dirty = false;
+      cache_put (run[i]);
+    }
+}
+
+/* Reads the CNT pinned, locked entries in RUN, which were just
+   assigned consecutive sectors, from disk and releases them. */
+static void
+load_run (struct cache_entry *run[], size_t cnt) 
+{
+  void *buffers[READ_AHEAD_RUN];
+  size_t i;
+
+  ASSERT (cnt > 0);
+  for (i = 0; i < cnt; i++)
+    buffers[i] = run[i]->data;
+  block_read_multi (fs_device, run[0]->sector, cnt, buffers);
+  for (i = 0; i < cnt; i++)
+    cache_put (run[i]);
+}
+
+/* Thread function that loads the sectors queued by
+   cache_read_ahead() into the cache.  Queued requests for
+   consecutive sectors are loaded together. */
+static void
+read_ahead (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      block_sector_t sectors[READ_AHEAD_RUN];
+      struct cache_entry *run[READ_AHEAD_RUN];
+      size_t sector_cnt = 0;
+      size_t run_cnt = 0;
+      size_t i;
+
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_cond, &read_ahead_lock);
+      do 
+        {
+          sectors[sector_cnt++] = read_ahead_queue[read_ahead_head];
+          read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+          read_ahead_cnt--;
+        }
+      while (read_ahead_cnt > 0 && sector_cnt < READ_AHEAD_RUN
+             && (read_ahead_queue[read_ahead_head]
+                 == sectors[sector_cnt - 1] + 1));
+      lock_release (&read_ahead_lock);
+
+      /* Sectors that turn out to be cached already split the run.
+         Entries are pinned in order of sector, so holding several
+         at once cannot deadlock. */
+      for (i = 0; i < sector_cnt; i++) 
+        {
+          bool hit;
+          struct cache_entry *e = cache_pin (sectors[i], &hit);
+          if (hit) 
+            {
+              cache_put (e);
+              if (run_cnt > 0)
+                load_run (run, run_cnt);
+              run_cnt = 0;
+            }
+          else
+            run[run_cnt++] = e;
+        }
+      if (run_cnt > 0)
+        load_run (run, run_cnt);
+    }
+}
+
+/* Thread function that periodically commits the running journal
+   transaction and writes dirty sectors to disk, so that they do
+   not linger in the cache indefinitely. */
+static void
+write_behind (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      timer_sleep (WRITE_BEHIND_TICKS);
+      journal_commit ();
+      cache_flush ();
+    }
+}
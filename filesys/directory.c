@@ -1,16 +1,93 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* In-memory index of the entries in a directory, shared by every
+   struct dir open on the directory's inode.  It maps each name
+   to the entry's offset, so that lookups do not have to read
+   the whole directory, and remembers free slots for dir_add().
+
+   An index is built from the directory's contents the first
+   time it is needed, and kept up to date by dir_add() and
+   dir_remove().  If memory runs short, the index is dropped and
+   lookups fall back to reading the directory until it can be
+   rebuilt.
+
+   The index's lock serializes all operations on the directory,
+   including reads of its entries.  When a directory operation
+   needs a second directory's lock, as dir_remove() does to make
+   sure that a subdirectory stays empty until it is removed, the
+   parent's lock is always acquired first. */
+struct dir_index 
+  {
+    struct list_elem elem;              /* Element in open_indexes. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    int open_cnt;                       /* Number of struct dirs. */
+    struct lock lock;                   /* Directory lock. */
+    bool built;                         /* Are NAMES and FREE valid? */
+    struct hash names;                  /* Hash of struct dir_name. */
+    struct list free;                   /* List of struct dir_slot. */
+  };
+
+/* A name in a dir_index. */
+struct dir_name 
+  {
+    struct hash_elem elem;              /* Element in dir_index names. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    off_t ofs;                          /* Offset of directory entry. */
+  };
+
+/* A free directory entry slot in a dir_index. */
+struct dir_slot 
+  {
+    struct list_elem elem;              /* Element in dir_index free. */
+    off_t ofs;                          /* Offset of free entry. */
+  };
+
+/* Indexes of open directories, so that opening a single
+   directory twice shares the same index. */
+static struct list open_indexes = LIST_INITIALIZER (open_indexes);
+static struct lock open_indexes_lock;   /* Protects open_indexes. */
+
+/* Cache of recently walked path components, mapping a name
+   within a directory to the named inode, so that resolving a
+   path does not have to open every directory along the way.
+
+   Entries are keyed by the containing directory's inode sector
+   and the name.  dir_remove() forgets the entry for the removed
+   name and, when a directory is removed, every entry within it,
+   so a cached entry never outlives the name it caches and a
+   reused sector is never mistaken for its previous owner. */
+struct dentry 
+  {
+    struct hash_elem elem;              /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in dentry_lru. */
+    block_sector_t parent;              /* Containing directory. */
+    char name[NAME_MAX + 1];            /* Null terminated name. */
+    block_sector_t sector;              /* Named inode's sector. */
+    bool is_dir;                        /* Is the inode a directory? */
+  };
+
+/* Maximum number of cached dentries. */
+#define DENTRY_CNT_MAX 256
+
+static struct hash dentries;            /* Hash of struct dentry. */
+static struct list dentry_lru;          /* Most recently used first. */
+static struct lock dentry_lock;         /* Protects the above. */
 
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    struct dir_index *index;            /* Shared index and lock. */
   };
 
 /* A single directory entry. */
@@ -21,12 +98,53 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+static struct dir_index *index_open (block_sector_t);
+static void index_close (struct dir_index *);
+static bool index_build (struct dir_index *, struct inode *);
+static void index_drop (struct dir_index *);
+static bool index_add_name (struct dir_index *, const struct dir_entry *,
+                            off_t ofs);
+static bool index_add_slot (struct dir_index *, off_t ofs);
+static hash_hash_func name_hash;
+static hash_less_func name_less;
+static hash_action_func name_free;
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+static struct dentry *dentry_find (block_sector_t parent, const char *name);
+static void dentry_insert (block_sector_t parent, const char *name,
+                           block_sector_t sector, bool is_dir);
+static void dentry_forget (block_sector_t parent, const char *name);
+static void dentry_purge (block_sector_t parent);
+static bool is_empty (struct inode *);
+
+/* Initializes the directory module. */
+void
+dir_init (void) 
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&dentry_lru);
+  lock_init (&dentry_lock);
+  lock_init (&open_indexes_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, with "." referring to itself and ".." to the
+   directory in sector PARENT.  Returns true if successful, false
+   on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir *dir;
+  bool success;
+
+  if (!inode_create (sector, entry_cnt * sizeof (struct dir_entry), true))
+    return false;
+  dir = dir_open (inode_open (sector));
+  success = (dir != NULL
+             && dir_add (dir, ".", sector)
+             && dir_add (dir, "..", parent));
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -35,7 +153,8 @@ struct dir *
 dir_open (struct inode *inode) 
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL
+      && (dir->index = index_open (inode_get_inumber (inode))) != NULL)
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -71,6 +190,7 @@ dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
+      index_close (dir->index);
       inode_close (dir->inode);
       free (dir);
     }
@@ -87,7 +207,8 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   DIR's lock must be held. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
@@ -97,6 +218,37 @@ lookup (const struct dir *dir, const char *name,
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
+  ASSERT (lock_held_by_current_thread (&dir->index->lock));
+
+  /* A removed directory keeps its entries until it is closed,
+     but nothing may be found or created in it. */
+  if (inode_is_removed (dir->inode))
+    return false;
+
+  if (index_build (dir->index, dir->inode)) 
+    {
+      struct dir_name key;
+      struct hash_elem *he;
+      struct dir_name *n;
+
+      if (strlen (name) > NAME_MAX)
+        return false;
+      strlcpy (key.name, name, sizeof key.name);
+      he = hash_find (&dir->index->names, &key.elem);
+      if (he == NULL)
+        return false;
+
+      n = hash_entry (he, struct dir_name, elem);
+      if (ep != NULL) 
+        {
+          ep->inode_sector = n->inode_sector;
+          strlcpy (ep->name, n->name, sizeof ep->name);
+          ep->in_use = true;
+        }
+      if (ofsp != NULL)
+        *ofsp = n->ofs;
+      return true;
+    }
 
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
@@ -124,10 +276,12 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir->index->lock);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  lock_release (&dir->index->lock);
 
   return *inode != NULL;
 }
@@ -152,8 +306,11 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  lock_acquire (&dir->index->lock);
+
+  /* Check that NAME is not in use and that DIR has not been
+     removed. */
+  if (inode_is_removed (dir->inode) || lookup (dir, name, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
@@ -163,10 +320,23 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  if (dir->index->built) 
+    {
+      if (!list_empty (&dir->index->free)) 
+        {
+          struct dir_slot *slot = list_entry (list_pop_front (&dir->index->free),
+                                              struct dir_slot, elem);
+          ofs = slot->ofs;
+          free (slot);
+        }
+      else
+        ofs = inode_length (dir->inode);
+    }
+  else
+    for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+         ofs += sizeof e) 
+      if (!e.in_use)
+        break;
 
   /* Write slot. */
   e.in_use = true;
@@ -174,24 +344,39 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+  /* Keep the index current. */
+  if (dir->index->built
+      && !(success ? index_add_name (dir->index, &e, ofs)
+           : ofs >= inode_length (dir->inode)
+             || index_add_slot (dir->index, ofs)))
+    index_drop (dir->index);
+
  done:
+  lock_release (&dir->index->lock);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs if there is no file with the given NAME, if NAME
+   is "." or "..", or if NAME is a directory that is not empty. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  struct dir *child = NULL;
   bool success = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (!strcmp (name, ".") || !strcmp (name, ".."))
+    return false;
+
+  lock_acquire (&dir->index->lock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -201,36 +386,404 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* A directory must be empty, and is kept locked until it has
+     been marked removed so that nothing can be added to it in
+     the meantime. */
+  if (inode_is_dir (inode)) 
+    {
+      child = dir_open (inode_reopen (inode));
+      if (child == NULL)
+        goto done;
+      lock_acquire (&child->index->lock);
+      if (!is_empty (inode))
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
+  /* Keep the index current. */
+  if (dir->index->built) 
+    {
+      struct dir_name key;
+      struct hash_elem *he;
+
+      strlcpy (key.name, name, sizeof key.name);
+      he = hash_delete (&dir->index->names, &key.elem);
+      ASSERT (he != NULL);
+      free (hash_entry (he, struct dir_name, elem));
+      if (!index_add_slot (dir->index, ofs))
+        index_drop (dir->index);
+    }
+
+  /* Forget cached paths through the entry. */
+  dentry_forget (inode_get_inumber (dir->inode), name);
+  if (inode_is_dir (inode))
+    dentry_purge (e.inode_sector);
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  if (child != NULL) 
+    {
+      if (lock_held_by_current_thread (&child->index->lock))
+        lock_release (&child->index->lock);
+      dir_close (child);
+    }
+  lock_release (&dir->index->lock);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  The "." and ".." entries are
+   skipped. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
+  lock_acquire (&dir->index->lock);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
-      if (e.in_use)
+      if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+  lock_release (&dir->index->lock);
+  return success;
+}
+
+/* Looks up NAME in the directory whose inode is in sector
+   DIR_SECTOR, consulting the dentry cache before the directory
+   itself.  If found, returns true and sets *SECTORP to the named
+   inode's sector and *IS_DIRP to whether it is a directory.
+   Otherwise, returns false. */
+bool
+dir_walk (block_sector_t dir_sector, const char *name,
+          block_sector_t *sectorp, bool *is_dirp) 
+{
+  struct dentry *d;
+  struct dir *dir;
+  struct dir_entry e;
+  struct inode *inode;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dentry_lock);
+  d = dentry_find (dir_sector, name);
+  if (d != NULL) 
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&dentry_lru, &d->lru_elem);
+      *sectorp = d->sector;
+      *is_dirp = d->is_dir;
+    }
+  lock_release (&dentry_lock);
+  if (d != NULL)
+    return true;
+
+  dir = dir_open (inode_open (dir_sector));
+  if (dir == NULL)
+    return false;
+
+  /* Cache the entry before releasing the directory's lock, so
+     that a dir_remove() of it cannot come in between and leave a
+     dentry for a freed inode behind. */
+  lock_acquire (&dir->index->lock);
+  inode = lookup (dir, name, &e, NULL) ? inode_open (e.inode_sector) : NULL;
+  if (inode != NULL) 
+    {
+      *sectorp = inode_get_inumber (inode);
+      *is_dirp = inode_is_dir (inode);
+      dentry_insert (dir_sector, name, *sectorp, *is_dirp);
+    }
+  lock_release (&dir->index->lock);
+  inode_close (inode);
+  dir_close (dir);
+  return inode != NULL;
+}
+
+/* Returns true if directory INODE contains no entries other
+   than "." and "..".  The directory's lock must be held. */
+static bool
+is_empty (struct inode *inode) 
+{
+  struct dir_entry e;
+  off_t ofs;
+
+  for (ofs = 0; inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
+      return false;
+  return true;
+}
+
+/* Returns the index for the directory whose inode is in SECTOR,
+   sharing it with other openers of the same directory, or a null
+   pointer if memory allocation fails. */
+static struct dir_index *
+index_open (block_sector_t sector) 
+{
+  struct dir_index *index;
+  struct list_elem *e;
+
+  lock_acquire (&open_indexes_lock);
+  for (e = list_begin (&open_indexes); e != list_end (&open_indexes);
+       e = list_next (e)) 
+    {
+      index = list_entry (e, struct dir_index, elem);
+      if (index->sector == sector) 
+        {
+          index->open_cnt++;
+          lock_release (&open_indexes_lock);
+          return index;
+        }
+    }
+
+  index = malloc (sizeof *index);
+  if (index == NULL
+      || !hash_init (&index->names, name_hash, name_less, NULL)) 
+    {
+      lock_release (&open_indexes_lock);
+      free (index);
+      return NULL;
+    }
+  list_push_front (&open_indexes, &index->elem);
+  index->sector = sector;
+  index->open_cnt = 1;
+  lock_init (&index->lock);
+  index->built = false;
+  list_init (&index->free);
+  lock_release (&open_indexes_lock);
+  return index;
+}
+
+/* Releases a reference to INDEX, freeing it if it was the
+   last.  Ignores a null pointer. */
+static void
+index_close (struct dir_index *index) 
+{
+  bool last;
+
+  if (index == NULL)
+    return;
+
+  lock_acquire (&open_indexes_lock);
+  last = --index->open_cnt == 0;
+  if (last)
+    list_remove (&index->elem);
+  lock_release (&open_indexes_lock);
+
+  if (last) 
+    {
+      index_drop (index);
+      hash_destroy (&index->names, NULL);
+      free (index);
+    }
+}
+
+/* Fills INDEX from the entries of directory INODE, unless that
+   has already been done.  Returns true if INDEX is usable, false
+   if memory ran out. */
+static bool
+index_build (struct dir_index *index, struct inode *inode) 
+{
+  struct dir_entry e;
+  off_t ofs;
+
+  if (index->built)
+    return true;
+
+  index->built = true;
+  for (ofs = 0; inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    if (!(e.in_use ? index_add_name (index, &e, ofs)
+                   : index_add_slot (index, ofs))) 
+      {
+        index_drop (index);
+        return false;
+      }
+  return true;
+}
+
+/* Empties INDEX and marks it as not built. */
+static void
+index_drop (struct dir_index *index) 
+{
+  hash_clear (&index->names, name_free);
+  while (!list_empty (&index->free))
+    free (list_entry (list_pop_front (&index->free), struct dir_slot, elem));
+  index->built = false;
+}
+
+/* Adds in-use directory entry E, at offset OFS, to INDEX.
+   Returns true if successful, false if out of memory. */
+static bool
+index_add_name (struct dir_index *index, const struct dir_entry *e,
+                off_t ofs) 
+{
+  struct dir_name *n = malloc (sizeof *n);
+  if (n == NULL)
+    return false;
+  strlcpy (n->name, e->name, sizeof n->name);
+  n->inode_sector = e->inode_sector;
+  n->ofs = ofs;
+  hash_insert (&index->names, &n->elem);
+  return true;
+}
+
+/* Records the free directory entry at offset OFS in INDEX.
+   Returns true if successful, false if out of memory. */
+static bool
+index_add_slot (struct dir_index *index, off_t ofs) 
+{
+  struct dir_slot *slot = malloc (sizeof *slot);
+  if (slot == NULL)
+    return false;
+  slot->ofs = ofs;
+  list_push_front (&index->free, &slot->elem);
+  return true;
+}
+
+/* Returns a hash of the name in dir_name E. */
+static unsigned
+name_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  return hash_string (hash_entry (e, struct dir_name, elem)->name);
+}
+
+/* Returns true if dir_name A's name precedes dir_name B's. */
+static bool
+name_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED) 
+{
+  return strcmp (hash_entry (a, struct dir_name, elem)->name,
+                 hash_entry (b, struct dir_name, elem)->name) < 0;
+}
+
+/* Frees dir_name E. */
+static void
+name_free (struct hash_elem *e, void *aux UNUSED) 
+{
+  free (hash_entry (e, struct dir_name, elem));
+}
+
+/* Returns the cached dentry for NAME in directory PARENT, or a
+   null pointer if there is none.  dentry_lock must be held. */
+static struct dentry *
+dentry_find (block_sector_t parent, const char *name) 
+{
+  struct dentry key;
+  struct hash_elem *he;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  he = hash_find (&dentries, &key.elem);
+  return he != NULL ? hash_entry (he, struct dentry, elem) : NULL;
+}
+
+/* Caches NAME in directory PARENT as referring to the inode in
+   SECTOR, evicting the least recently used dentry if the cache
+   is full.  Caching is skipped if memory is short.  PARENT's
+   lock must be held, so that the entry cannot be removed before
+   it is cached. */
+static void
+dentry_insert (block_sector_t parent, const char *name,
+               block_sector_t sector, bool is_dir) 
+{
+  struct dentry *d = malloc (sizeof *d);
+  if (d == NULL)
+    return;
+  d->parent = parent;
+  strlcpy (d->name, name, sizeof d->name);
+  d->sector = sector;
+  d->is_dir = is_dir;
+
+  lock_acquire (&dentry_lock);
+  if (hash_insert (&dentries, &d->elem) != NULL) 
+    {
+      /* Another thread cached it first. */
+      lock_release (&dentry_lock);
+      free (d);
+      return;
+    }
+  list_push_front (&dentry_lru, &d->lru_elem);
+  if (hash_size (&dentries) > DENTRY_CNT_MAX) 
+    {
+      struct dentry *victim = list_entry (list_pop_back (&dentry_lru),
+                                          struct dentry, lru_elem);
+      hash_delete (&dentries, &victim->elem);
+      free (victim);
+    }
+  lock_release (&dentry_lock);
+}
+
+/* Drops any cached dentry for NAME in directory PARENT. */
+static void
+dentry_forget (block_sector_t parent, const char *name) 
+{
+  struct dentry *d;
+
+  lock_acquire (&dentry_lock);
+  d = dentry_find (parent, name);
+  if (d != NULL) 
+    {
+      hash_delete (&dentries, &d->elem);
+      list_remove (&d->lru_elem);
+      free (d);
+    }
+  lock_release (&dentry_lock);
+}
+
+/* Drops every cached dentry within directory PARENT. */
+static void
+dentry_purge (block_sector_t parent) 
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dentry_lock);
+  for (e = list_begin (&dentry_lru); e != list_end (&dentry_lru); e = next) 
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->parent == parent) 
+        {
+          hash_delete (&dentries, &d->elem);
+          list_remove (&d->lru_elem);
+          free (d);
+        }
+    }
+  lock_release (&dentry_lock);
+}
+
+/* Returns a hash of dentry E's directory and name. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct dentry *d = hash_entry (e, struct dentry, elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED) 
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
 }
@@ -1,16 +1,29 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window bounds, in sectors.  The window starts at
+   the minimum when a file is first read sequentially, doubles on
+   each further sequential read, and drops to zero on a read at
+   any other offset. */
+#define RA_WINDOW_MIN 2
+#define RA_WINDOW_MAX 16
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Offset a sequential read starts at. */
+    off_t ra_end;               /* End of data already read ahead. */
+    int ra_window;              /* Read-ahead window, in sectors. */
   };
 
+static void read_ahead (struct file *, off_t ofs, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +36,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -69,6 +85,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +98,16 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +120,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -166,3 +183,43 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* Updates FILE's read-ahead state after SIZE bytes were read
+   from it at offset OFS.  If the read continued where the
+   previous one left off, widens the read-ahead window and
+   requests the sectors in it that were not already requested;
+   otherwise, turns read-ahead off until reads become sequential
+   again. */
+static void
+read_ahead (struct file *file, off_t ofs, off_t size) 
+{
+  off_t end = ofs + size;
+  off_t ra_start, ra_limit;
+
+  if (size <= 0)
+    return;
+
+  if (ofs != file->ra_next) 
+    {
+      file->ra_window = 0;
+      file->ra_next = end;
+      file->ra_end = 0;
+      return;
+    }
+  file->ra_next = end;
+  if (file->ra_window == 0)
+    file->ra_window = RA_WINDOW_MIN;
+  else if (file->ra_window < RA_WINDOW_MAX)
+    file->ra_window *= 2;
+
+  ra_start = ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  if (ra_start < file->ra_end)
+    ra_start = file->ra_end;
+  ra_limit = ROUND_UP (end, BLOCK_SECTOR_SIZE)
+             + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (ra_start < ra_limit) 
+    {
+      inode_read_ahead (file->inode, ra_limit - ra_start, ra_start);
+      file->ra_end = ra_limit;
+    }
+}
@@ -2,15 +2,22 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
 static void do_format (void);
+static bool resolve (const char *path, block_sector_t *dir_sector,
+                     char name[NAME_MAX + 1]);
+static bool create (const char *path, off_t initial_size, bool is_dir);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -21,7 +28,10 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  journal_init (format);
+  cache_init ();
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
@@ -36,6 +46,8 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_commit ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -45,20 +57,20 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
-  dir_close (dir);
+  return create (name, initial_size, false);
+}
 
-  return success;
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name) 
+{
+  return create (name, 0, true);
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -66,38 +78,166 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  struct inode *inode = NULL;
+  char base[NAME_MAX + 1];
+  block_sector_t dir_sector, sector;
+  bool is_dir;
 
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
-  dir_close (dir);
-
-  return file_open (inode);
+  if (!resolve (name, &dir_sector, base)
+      || !dir_walk (dir_sector, base, &sector, &is_dir))
+    return NULL;
+  return file_open (inode_open (sector));
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char base[NAME_MAX + 1];
+  block_sector_t dir_sector;
+  struct dir *dir;
+  bool success;
+
+  if (!resolve (name, &dir_sector, base))
+    return false;
+  journal_begin ();
+  dir = dir_open (inode_open (dir_sector));
+  success = dir != NULL && dir_remove (dir, base);
   dir_close (dir); 
+  journal_end ();
+
+  return success;
+}
+
+/* Changes the current thread's working directory to the
+   directory named NAME.
+   Returns true if successful, false on failure.
+   Fails if NAME does not exist or is not a directory,
+   or if an internal memory allocation fails. */
+bool
+filesys_chdir (const char *name) 
+{
+  struct thread *cur = thread_current ();
+  char base[NAME_MAX + 1];
+  block_sector_t dir_sector, sector;
+  bool is_dir;
+  struct dir *dir;
+
+  if (!resolve (name, &dir_sector, base)
+      || !dir_walk (dir_sector, base, &sector, &is_dir)
+      || !is_dir)
+    return false;
+  dir = dir_open (inode_open (sector));
+  if (dir == NULL)
+    return false;
+
+  dir_close (cur->cwd);
+  cur->cwd = dir;
+  return true;
+}
+
+/* Creates a file or, if IS_DIR, a directory at PATH.  A file is
+   given INITIAL_SIZE bytes.  Returns true if successful, false
+   otherwise. */
+static bool
+create (const char *path, off_t initial_size, bool is_dir) 
+{
+  char name[NAME_MAX + 1];
+  block_sector_t dir_sector;
+  block_sector_t inode_sector = 0;
+  struct dir *dir;
+  bool success;
+
+  if (!resolve (path, &dir_sector, name))
+    return false;
+  journal_begin ();
+  dir = dir_open (inode_open (dir_sector));
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && (is_dir
+                 ? dir_create (inode_sector, 16, dir_sector)
+                 : inode_create (inode_sector, initial_size, false))
+             && dir_add (dir, name, inode_sector));
+  if (!success && inode_sector != 0) 
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+  journal_end ();
 
   return success;
 }
+
+/* Walks PATH, which is absolute if it begins with "/" and
+   otherwise relative to the current thread's working directory,
+   up to its last component.  On success, returns true, sets
+   *DIR_SECTOR to the inode sector of the directory that contains
+   the last component, and copies the component into NAME.  A
+   path with no components, such as "/", yields the directory
+   itself under the name ".".  Returns false if PATH is empty, a
+   component is too long, or a component other than the last
+   does not exist or is not a directory.
+
+   Each step goes through dir_walk(), so walking a recently used
+   path normally opens no directories at all. */
+static bool
+resolve (const char *path, block_sector_t *dir_sector,
+         char name[NAME_MAX + 1]) 
+{
+  struct dir *cwd = thread_current ()->cwd;
+  block_sector_t sector;
+  bool is_dir;
+
+  if (*path == '\0')
+    return false;
+  if (*path == '/' || cwd == NULL)
+    sector = ROOT_DIR_SECTOR;
+  else if (inode_is_removed (dir_get_inode (cwd)))
+    return false;
+  else
+    sector = inode_get_inumber (dir_get_inode (cwd));
+
+  name[0] = '\0';
+  for (;;) 
+    {
+      size_t len;
+
+      while (*path == '/')
+        path++;
+      if (*path == '\0')
+        break;
+      len = strcspn (path, "/");
+      if (len > NAME_MAX)
+        return false;
+
+      /* The previous component is not the last, so it must be a
+         directory to descend into. */
+      if (name[0] != '\0'
+          && (!dir_walk (sector, name, &sector, &is_dir) || !is_dir))
+        return false;
+
+      memcpy (name, path, len);
+      name[len] = '\0';
+      path += len;
+    }
+  if (name[0] == '\0')
+    strlcpy (name, ".", NAME_MAX + 1);
+
+  *dir_sector = sector;
+  return true;
+}
 
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  journal_begin ();
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
+  journal_end ();
+  journal_commit ();
   printf ("done.\n");
 }
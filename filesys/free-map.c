@@ -1,12 +1,63 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
+#include <tree.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects the free map. */
+
+/* The bitmap above is the authoritative, on-disk record of which
+   sectors are free.  To avoid scanning it on every allocation,
+   we also index its runs of free sectors ("extents") in two
+   trees: one ordered by size, for best-fit allocation, and one
+   ordered by starting sector, for coalescing adjacent extents
+   when sectors are released.  Both take O(lg n) time in the
+   number of extents.
+
+   If memory for a new extent cannot be allocated when sectors
+   are released, those sectors are left out of the index.  They
+   remain free in the bitmap and are indexed again the next time
+   the free map is opened. */
+struct extent
+  {
+    block_sector_t start;               /* First free sector. */
+    block_sector_t size;                /* Number of free sectors. */
+    struct tree_elem size_elem;         /* Element in by_size. */
+    struct tree_elem start_elem;        /* Element in by_start. */
+  };
+
+static struct tree by_size;             /* Extents by size, then start. */
+static struct tree by_start;            /* Extents by start. */
+
+/* Sectors released in the running journal transaction.  They are
+   free in the bitmap but kept out of the extent index until the
+   transaction commits, because until then a crash would bring
+   back the metadata that still refers to them, and so they must
+   not be reallocated and overwritten. */
+struct release
+  {
+    struct list_elem elem;              /* Element in releases. */
+    block_sector_t start;               /* First released sector. */
+    block_sector_t size;                /* Number of released sectors. */
+  };
+
+static struct list releases;
+
+static tree_less_func size_less, start_less;
+static void index_build (void);
+static void index_clear (void);
+static void extent_free (struct tree_elem *, void *aux);
+static bool extent_insert (block_sector_t start, block_sector_t size);
+static void extent_remove (struct extent *);
+static void extent_add (block_sector_t start, block_sector_t size);
 
 /* Initializes the free map. */
 void
@@ -17,36 +68,121 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTOR_CNT, true);
+  lock_init (&free_map_lock);
+  list_init (&releases);
+
+  tree_init (&by_size, size_less, NULL);
+  tree_init (&by_start, start_less, NULL);
+  index_build ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  Chooses the smallest run of free
+   sectors that is large enough, preferring lower-numbered
+   sectors among runs of equal size.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
    written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct extent probe = { .start = 0, .size = cnt };
+  struct tree_elem *e;
+  struct extent *x;
+  block_sector_t sector;
+
+  ASSERT (cnt > 0);
+
+  /* Find the best fit. */
+  lock_acquire (&free_map_lock);
+  e = tree_ceil (&by_size, &probe.size_elem);
+  if (e == NULL)
+    {
+      lock_release (&free_map_lock);
+      return false;
+    }
+  x = tree_entry (e, struct extent, size_elem);
+  sector = x->start;
+
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  if (free_map_file != NULL && !bitmap_write (free_map, free_map_file))
     {
       bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      lock_release (&free_map_lock);
+      return false;
+    }
+
+  /* Trim the extent.  Its position relative to its neighbors in
+     by_start does not change, so only by_size needs updating. */
+  if (x->size == cnt)
+    extent_remove (x);
+  else
+    {
+      tree_delete (&by_size, &x->size_elem);
+      x->start += cnt;
+      x->size -= cnt;
+      tree_insert (&by_size, &x->size_elem);
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+
+  *sectorp = sector;
+  return true;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Marks CNT sectors starting at SECTOR free.  They become
+   available for allocation once the running journal transaction
+   commits. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  struct release *r;
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
   bitmap_write (free_map, free_map_file);
+
+  /* Files are mostly released in ascending order of sectors, so
+     try to extend the latest release first. */
+  r = (list_empty (&releases) ? NULL
+       : list_entry (list_back (&releases), struct release, elem));
+  if (r != NULL && r->start + r->size == sector)
+    r->size += cnt;
+  else if (r != NULL && sector + cnt == r->start) 
+    {
+      r->start = sector;
+      r->size += cnt;
+    }
+  else 
+    {
+      /* If there is no memory, the sectors stay out of the index
+         until the free map is next opened. */
+      r = malloc (sizeof *r);
+      if (r != NULL) 
+        {
+          r->start = sector;
+          r->size = cnt;
+          list_push_back (&releases, &r->elem);
+        }
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors released in the transaction that the journal
+   has just committed available for allocation. */
+void
+free_map_commit (void) 
+{
+  lock_acquire (&free_map_lock);
+  while (!list_empty (&releases)) 
+    {
+      struct release *r = list_entry (list_pop_front (&releases),
+                                      struct release, elem);
+      extent_add (r->start, r->size);
+      free (r);
+    }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +194,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  index_build ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -73,7 +210,7 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -83,3 +220,135 @@ free_map_create (void)
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/* Orders extents by size, then by starting sector. */
+static bool
+size_less (const struct tree_elem *a_, const struct tree_elem *b_,
+           void *aux UNUSED) 
+{
+  const struct extent *a = tree_entry (a_, struct extent, size_elem);
+  const struct extent *b = tree_entry (b_, struct extent, size_elem);
+
+  return a->size != b->size ? a->size < b->size : a->start < b->start;
+}
+
+/* Orders extents by starting sector. */
+static bool
+start_less (const struct tree_elem *a_, const struct tree_elem *b_,
+            void *aux UNUSED) 
+{
+  const struct extent *a = tree_entry (a_, struct extent, start_elem);
+  const struct extent *b = tree_entry (b_, struct extent, start_elem);
+
+  return a->start < b->start;
+}
+
+/* Rebuilds the extent index from the free map bitmap. */
+static void
+index_build (void) 
+{
+  size_t size = bitmap_size (free_map);
+  size_t start, end;
+
+  index_clear ();
+  for (start = bitmap_scan (free_map, 0, 1, false);
+       start != BITMAP_ERROR;
+       start = end < size ? bitmap_scan (free_map, end, 1, false)
+                          : BITMAP_ERROR)
+    {
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      if (!extent_insert (start, end - start))
+        PANIC ("out of memory indexing free map");
+    }
+}
+
+/* Removes and frees every extent in the index. */
+static void
+index_clear (void) 
+{
+  tree_clear (&by_start, NULL);
+  tree_clear (&by_size, extent_free);
+}
+
+/* Frees the extent containing size_elem E. */
+static void
+extent_free (struct tree_elem *e, void *aux UNUSED) 
+{
+  free (tree_entry (e, struct extent, size_elem));
+}
+
+/* Adds a new extent of SIZE sectors starting at START to the
+   index.  Returns true if successful, false on failure to
+   allocate memory. */
+static bool
+extent_insert (block_sector_t start, block_sector_t size) 
+{
+  struct extent *x = malloc (sizeof *x);
+  if (x == NULL)
+    return false;
+  x->start = start;
+  x->size = size;
+  tree_insert (&by_size, &x->size_elem);
+  tree_insert (&by_start, &x->start_elem);
+  return true;
+}
+
+/* Adds the CNT sectors starting at SECTOR to the index, merging
+   them with the free extents just before and after if they are
+   adjacent. */
+static void
+extent_add (block_sector_t sector, block_sector_t cnt) 
+{
+  struct extent probe = { .start = sector };
+  struct extent *prev = NULL, *next = NULL;
+  struct tree_elem *e;
+
+  e = tree_floor (&by_start, &probe.start_elem);
+  if (e != NULL)
+    {
+      prev = tree_entry (e, struct extent, start_elem);
+      if (prev->start + prev->size != sector)
+        prev = NULL;
+    }
+  e = tree_ceil (&by_start, &probe.start_elem);
+  if (e != NULL)
+    {
+      next = tree_entry (e, struct extent, start_elem);
+      if (next->start != sector + cnt)
+        next = NULL;
+    }
+
+  if (prev != NULL)
+    {
+      tree_delete (&by_size, &prev->size_elem);
+      prev->size += cnt;
+      if (next != NULL)
+        {
+          prev->size += next->size;
+          extent_remove (next);
+        }
+      tree_insert (&by_size, &prev->size_elem);
+    }
+  else if (next != NULL)
+    {
+      /* Moving NEXT's start down to SECTOR keeps its order in
+         by_start, since no extent lies in between. */
+      tree_delete (&by_size, &next->size_elem);
+      next->start = sector;
+      next->size += cnt;
+      tree_insert (&by_size, &next->size_elem);
+    }
+  else
+    extent_insert (sector, cnt);
+}
+
+/* Removes extent X from the index and frees it. */
+static void
+extent_remove (struct extent *x) 
+{
+  tree_delete (&by_size, &x->size_elem);
+  tree_delete (&by_start, &x->start_elem);
+  free (x);
+}
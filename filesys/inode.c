@@ -1,23 +1,54 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A file's data sectors are found through a multilevel index:
+   the first DIRECT_CNT sectors are listed in the inode itself,
+   the next PTRS_PER_SECTOR through a single indirect sector, and
+   the rest through a doubly indirect sector that points to up to
+   PTRS_PER_SECTOR more indirect sectors.
+
+   A pointer of 0 means that the sector, or the whole subtree
+   below an indirect pointer, has not been allocated.  (Sector 0
+   holds the free map's inode, so it is never a data sector.)
+   Such holes read as zeros and are allocated when first
+   written, so a file may be sparse.
+
+   Inodes and index sectors, and the data of directories and of
+   the free map, are metadata, written through the journal so
+   that a crash cannot leave them inconsistent.  The data of
+   ordinary files is written to the cache directly. */
+#define DIRECT_CNT 123
+#define PTRS_PER_SECTOR ((off_t) (BLOCK_SECTOR_SIZE \
+                                  / sizeof (block_sector_t)))
+#define INODE_SECTORS_MAX (DIRECT_CNT + PTRS_PER_SECTOR \
+                           + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* Largest possible file size, in bytes. */
+#define INODE_LENGTH_MAX (INODE_SECTORS_MAX * BLOCK_SECTOR_SIZE)
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect sector. */
+    block_sector_t doubly_indirect;     /* Doubly indirect sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t is_dir;                    /* 1 if a directory, 0 if not. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,46 +62,97 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open bucket. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rw;                   /* Guards length, index, data. */
     struct inode_disk data;             /* Inode content. */
   };
 
+static block_sector_t index_lookup (struct inode_disk *, off_t idx,
+                                    bool create, bool *changed);
+static bool allocate_zeroed (block_sector_t *);
+static block_sector_t index_slot (block_sector_t *, bool create,
+                                  bool *changed);
+static block_sector_t index_entry (block_sector_t, off_t idx, bool create);
+static void index_release (struct inode_disk *);
+static void index_release_tree (block_sector_t, int level);
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, or 0 if that byte lies in a hole or past the
+   maximum file size.  If CREATE is true, allocates the sector,
+   and any indirect sectors needed to reach it, if it does not
+   exist yet, returning 0 only if allocation fails; INODE's lock
+   must then be held for writing. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool create) 
 {
+  block_sector_t sector;
+  bool changed = false;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  ASSERT (!create || rwlock_held_by_current_thread (&inode->rw));
+
+  sector = index_lookup (&inode->data, pos / BLOCK_SECTOR_SIZE,
+                         create, &changed);
+  if (changed)
+    cache_write_meta (inode->sector, &inode->data);
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, so that opening a single inode twice returns the
+   same `struct inode'.
+
+   The inodes are spread by sector over OPEN_BUCKET_CNT buckets,
+   each a hash table with its own lock, so that opening or
+   closing an inode is a constant-time operation that contends
+   only with callers whose inodes share its bucket.  A bucket's
+   lock also protects the open_cnt of each inode in it. */
+#define OPEN_BUCKET_CNT 64
+
+struct open_bucket 
+  {
+    struct lock lock;                   /* Protects the bucket. */
+    struct hash inodes;                 /* Hash of struct inode. */
+  };
+
+static struct open_bucket open_buckets[OPEN_BUCKET_CNT];
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Returns the bucket for the inode in SECTOR.  Consecutive
+   sectors go to different buckets. */
+static struct open_bucket *
+bucket_of (block_sector_t sector) 
+{
+  return &open_buckets[sector % OPEN_BUCKET_CNT];
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  struct open_bucket *b;
+
+  for (b = open_buckets; b < open_buckets + OPEN_BUCKET_CNT; b++) 
+    {
+      lock_init (&b->lock);
+      if (!hash_init (&b->inodes, inode_hash, inode_less, NULL))
+        PANIC ("out of memory allocating open inode table");
+    }
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is marked as a directory if IS_DIR is true.
+   Must be called within a journal operation.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -81,25 +163,38 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (length > INODE_LENGTH_MAX)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      bool changed;
+      size_t i;
+
+      /* The initial data is left as a hole, so that creating a
+         large file modifies only a bounded number of sectors in
+         a single journal operation.  The free map is the
+         exception: its data is allocated up front, because it may
+         not allocate sectors while writing itself out. */
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      disk_inode->is_dir = is_dir;
+      success = true;
+      if (sector != FREE_MAP_SECTOR)
+        sectors = 0;
+      for (i = 0; i < sectors; i++)
+        if (index_lookup (disk_inode, i, true, &changed) == 0) 
+          {
+            success = false;
+            break;
+          }
+
+      if (success)
+        cache_write_meta (sector, disk_inode);
+      else
+        index_release (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,33 +206,49 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct open_bucket *b = bucket_of (sector);
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  lock_acquire (&b->lock);
+  e = hash_find (&b->inodes, &key.elem);
+  if (e != NULL) 
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&b->lock);
+      return inode; 
     }
+  lock_release (&b->lock);
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, reading the disk inode without holding the
+     bucket lock. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  rwlock_init (&inode->rw);
+  cache_read (inode->sector, &inode->data);
+
+  /* Another thread may have opened the inode meanwhile.  If so,
+     use its copy instead. */
+  lock_acquire (&b->lock);
+  e = hash_insert (&b->inodes, &inode->elem);
+  if (e != NULL) 
+    {
+      free (inode);
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+    }
+  lock_release (&b->lock);
   return inode;
 }
 
@@ -145,8 +256,13 @@ inode_open (block_sector_t sector)
 struct inode *
 inode_reopen (struct inode *inode)
 {
-  if (inode != NULL)
-    inode->open_cnt++;
+  if (inode != NULL) 
+    {
+      struct open_bucket *b = bucket_of (inode->sector);
+      lock_acquire (&b->lock);
+      inode->open_cnt++;
+      lock_release (&b->lock);
+    }
   return inode;
 }
 
@@ -163,22 +279,31 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  struct open_bucket *b;
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  /* Remove from the open inodes if this was the last opener. */
+  b = bucket_of (inode->sector);
+  lock_acquire (&b->lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&b->inodes, &inode->elem);
+  lock_release (&b->lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          journal_begin ();
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          index_release (&inode->data);
+          journal_end ();
         }
 
       free (inode); 
@@ -194,20 +319,37 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if INODE has been marked for deletion. */
+bool
+inode_is_removed (const struct inode *inode) 
+{
+  return inode->removed;
+}
+
+/* Returns true if INODE is a directory, false if it is an
+   ordinary file. */
+bool
+inode_is_dir (const struct inode *inode) 
+{
+  return inode->data.is_dir != 0;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Any number of reads of an inode may proceed at once, but not
+   while it is being written. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rw);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,59 +362,86 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
+/* Asks for the sectors holding the SIZE bytes of INODE starting
+   at OFFSET to be read into the buffer cache in the background,
+   in anticipation of their being read soon.  Bytes past the end
+   of INODE are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset) 
+{
+  off_t end = offset + size;
+  off_t pos;
+
+  rwlock_acquire_read (&inode->rw);
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (pos = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); pos < end;
+       pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos, false);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+  rwlock_release_read (&inode->rw);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up, the maximum file size is
+   reached, or an error occurs.
+   Writing past end of file extends the inode.  Any gap between
+   the old end of file and OFFSET is left as a hole that reads
+   as zeros.
+   A write excludes all other reads and writes of INODE, so
+   that it is atomic with respect to them.
+
+   Each sector is written in its own journal operation, since a
+   long write may allocate more index sectors than fit in one.
+   For the same reason, a directory, whose contents are
+   metadata, may only be written within an operation begun by
+   the caller. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool meta = inode->data.is_dir || inode->sector == FREE_MAP_SECTOR;
+
+  ASSERT (!meta || thread_current ()->journal_depth > 0);
 
-  if (inode->deny_write_cnt)
-    return 0;
+  rwlock_acquire_write (&inode->rw);
+  if (inode->deny_write_cnt) 
+    {
+      rwlock_release_write (&inode->rw);
+      return 0;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in largest file, bytes left in sector, lesser
+         of the two. */
+      off_t inode_left = INODE_LENGTH_MAX - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,38 +450,34 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      journal_begin ();
+      sector_idx = byte_to_sector (inode, offset, true);
+      if (sector_idx == 0) 
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          journal_end ();
+          break;
         }
-      else 
+      if (meta)
+        cache_write_meta_at (sector_idx, buffer + bytes_written,
+                             sector_ofs, chunk_size);
+      else
+        cache_write_at (sector_idx, buffer + bytes_written,
+                        sector_ofs, chunk_size);
+
+      /* Extend the file now that its new data is in place. */
+      if (offset + chunk_size > inode->data.length) 
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          inode->data.length = offset + chunk_size;
+          cache_write_meta (inode->sector, &inode->data);
         }
+      journal_end ();
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  rwlock_release_write (&inode->rw);
 
   return bytes_written;
 }
@@ -322,8 +487,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +499,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -343,3 +512,128 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Returns the sector that holds data sector IDX of the inode
+   whose on-disk form is DISK, or 0 if it is a hole or IDX is too
+   large.  If CREATE is true, allocates the data sector and any
+   indirect sectors leading to it that do not yet exist,
+   returning 0 only on failure, and sets *CHANGED to true if
+   DISK itself was modified. */
+static block_sector_t
+index_lookup (struct inode_disk *disk, off_t idx, bool create,
+              bool *changed) 
+{
+  block_sector_t sector;
+
+  if (idx < DIRECT_CNT)
+    return index_slot (&disk->direct[idx], create, changed);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR) 
+    {
+      sector = index_slot (&disk->indirect, create, changed);
+      return sector != 0 ? index_entry (sector, idx, create) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR) 
+    {
+      sector = index_slot (&disk->doubly_indirect, create, changed);
+      if (sector != 0)
+        sector = index_entry (sector, idx / PTRS_PER_SECTOR, create);
+      return sector != 0 ? index_entry (sector, idx % PTRS_PER_SECTOR,
+                                        create) : 0;
+    }
+
+  return 0;
+}
+
+/* Allocates a sector and fills it with zeros, storing its number
+   into *SECTORP.  Returns true if successful. */
+static bool
+allocate_zeroed (block_sector_t *sectorp) 
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns the sector that in-memory pointer *SLOT points to.  If
+   it is 0 and CREATE is true, first allocates a zeroed sector,
+   points *SLOT to it, and sets *CHANGED to true. */
+static block_sector_t
+index_slot (block_sector_t *slot, bool create, bool *changed) 
+{
+  if (*slot == 0 && create && allocate_zeroed (slot))
+    *changed = true;
+  return *slot;
+}
+
+/* Returns pointer IDX within indirect sector SECTOR.  If it is 0
+   and CREATE is true, first allocates a zeroed sector and stores
+   a pointer to it there. */
+static block_sector_t
+index_entry (block_sector_t sector, off_t idx, bool create) 
+{
+  block_sector_t ptr;
+
+  cache_read_at (sector, &ptr, idx * sizeof ptr, sizeof ptr);
+  if (ptr == 0 && create && allocate_zeroed (&ptr))
+    cache_write_meta_at (sector, &ptr, idx * sizeof ptr, sizeof ptr);
+  return ptr;
+}
+
+/* Releases every data and indirect sector reachable from
+   DISK. */
+static void
+index_release (struct inode_disk *disk) 
+{
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    index_release_tree (disk->direct[i], 0);
+  index_release_tree (disk->indirect, 1);
+  index_release_tree (disk->doubly_indirect, 2);
+}
+
+/* Releases SECTOR, which is a data sector if LEVEL is 0, an
+   indirect sector if LEVEL is 1, or a doubly indirect sector if
+   LEVEL is 2, along with all the sectors below it. */
+static void
+index_release_tree (block_sector_t sector, int level) 
+{
+  if (sector == 0)
+    return;
+
+  if (level > 0) 
+    {
+      off_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++) 
+        {
+          block_sector_t ptr;
+          cache_read_at (sector, &ptr, i * sizeof ptr, sizeof ptr);
+          index_release_tree (ptr, level - 1);
+        }
+    }
+  free_map_release (sector, 1);
+}
+
+/* Returns a hash of inode E's sector. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED) 
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
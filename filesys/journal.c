@@ -0,0 +1,420 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/shutdown.h"
+
+/* Write-ahead journal of file system metadata.
+
+   Every change to metadata (inodes, indirect sectors, directory
+   contents and the free map) is made by an operation bracketed
+   by journal_begin() and journal_end().  The sectors modified
+   by operations are collected into a single running
+   transaction, and stay in the buffer cache, unwritten, until
+   the transaction commits.
+
+   To commit, the journal copies the modified sectors into its
+   log, then writes a header that lists their home locations.
+   Writing the header is the commit point.  Afterward the sectors
+   are written home and the header is cleared.  If the system
+   crashes after the commit point, journal_init() finishes the
+   job at the next boot by copying the logged sectors home again,
+   in time proportional to the size of the log rather than that
+   of the disk.  If it crashes before, none of the transaction's
+   changes reach the disk.
+
+   Commits are batched: operations keep joining the running
+   transaction until the log might not hold another one, the
+   write-behind thread calls journal_commit(), or the file system
+   is shut down.  A transaction commits only after all of its
+   operations have ended, so each operation is atomic.
+
+   Ordinary file data is not journaled. */
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Log sectors reserved for each operation.  The free map is
+   written whole whenever it changes, but a sector is logged only
+   once per transaction, so room for the free map is reserved
+   once per transaction instead (see map_reserve).  The largest
+   operation, creating a directory, may
+   modify the new directory's inode and first data sector, and
+   two sectors of the parent's entries plus the parent's inode and
+   indirect sectors if the parent grows. */
+#define OP_SECTORS 12
+
+/* Buffer cache entries that a full transaction leaves free, for
+   the sectors that threads in operations have pinned and those
+   that the read-ahead thread is loading.  Logged sectors cannot
+   be evicted, so without these an operation could wait forever
+   for a cache entry while the transaction waits for it to end. */
+#define CACHE_SLACK 16
+
+/* Number of log sectors read or written with a single
+   block_read_multi() or block_write_multi() call. */
+#define LOG_BATCH 8
+
+/* On-disk journal header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t cnt;                       /* Sectors logged, 0 if none. */
+    block_sector_t home[JOURNAL_CAP];   /* Home of each logged sector. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8 - 4 * JOURNAL_CAP];
+  };
+
+static struct lock journal_lock;        /* Protects the members below. */
+static struct condition journal_cond;   /* Signaled as operations end. */
+static block_sector_t logged[JOURNAL_CAP]; /* Running transaction. */
+static size_t logged_cnt;               /* Number of sectors in it. */
+static int op_cnt;                      /* Operations in progress. */
+static size_t map_reserve;              /* Log sectors for free map. */
+static bool committing;                 /* Commit in progress? */
+static bool commit_wanted;              /* Commit once ops drain? */
+
+/* Used only by the thread that is committing. */
+static struct journal_header header;
+static uint8_t buffers[LOG_BATCH][BLOCK_SECTOR_SIZE];
+
+/* Statistics. */
+static long long commit_cnt;            /* Transactions committed. */
+static long long log_write_cnt;         /* Sectors written to log. */
+
+/* Journal writes until an injected crash, or 0 for none. */
+static unsigned crash_countdown;
+
+/* Phase of the next commit in which to inject a crash. */
+static enum journal_phase crash_phase;
+
+static void commit (void);
+static void write_header (size_t cnt);
+static void crash_at_phase (enum journal_phase, size_t cnt);
+static size_t load_batch (size_t first, size_t cnt);
+static void journal_write (block_sector_t, size_t cnt,
+                           const void *const bufs[]);
+
+/* Initializes the journal.  If FORMAT is true, creates an empty
+   journal; otherwise, replays any transaction that committed but
+   had not been written home before the system last stopped.
+   Must be called before the buffer cache holds any sector. */
+void
+journal_init (bool format) 
+{
+  /* If this assertion fails, the header is not exactly one
+     sector in size. */
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+  ASSERT (JOURNAL_CAP + CACHE_SLACK <= CACHE_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+
+  /* A transaction may rewrite the whole free map and its inode.
+     With JOURNAL_CAP at 48, this limits the file system device
+     to 35 free map sectors, that is, 143,360 sectors or 70 MB. */
+  map_reserve = DIV_ROUND_UP (DIV_ROUND_UP (block_size (fs_device), 8),
+                              BLOCK_SECTOR_SIZE) + 1;
+  if (map_reserve + OP_SECTORS > JOURNAL_CAP)
+    PANIC ("file system device too large for journal");
+
+  if (!format) 
+    {
+      block_read (fs_device, JOURNAL_SECTOR, &header);
+      if (header.magic == JOURNAL_MAGIC && header.cnt > 0
+          && header.cnt <= JOURNAL_CAP) 
+        {
+          void *bufs[LOG_BATCH];
+          size_t i, j;
+
+          for (j = 0; j < LOG_BATCH; j++)
+            bufs[j] = buffers[j];
+          for (i = 0; i < header.cnt; i += LOG_BATCH) 
+            {
+              size_t n = (header.cnt - i < LOG_BATCH
+                          ? header.cnt - i : LOG_BATCH);
+              block_read_multi (fs_device, JOURNAL_SECTOR + 1 + i, n, bufs);
+              for (j = 0; j < n; j++)
+                block_write (fs_device, header.home[i + j], buffers[j]);
+            }
+          printf ("Journal: replayed %zu sectors.\n", (size_t) header.cnt);
+        }
+    }
+  write_header (0);
+}
+
+/* Begins an operation that modifies metadata, waiting if needed
+   until the running transaction has room for it.  Operations
+   nest: only the outermost journal_begin() and journal_end() in
+   a thread take effect. */
+void
+journal_begin (void) 
+{
+  if (thread_current ()->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (committing || commit_wanted
+         || (logged_cnt + map_reserve + (op_cnt + 1) * OP_SECTORS
+             > JOURNAL_CAP)) 
+    {
+      if (!committing && op_cnt == 0)
+        commit ();
+      else 
+        {
+          if (!committing)
+            commit_wanted = true;
+          cond_wait (&journal_cond, &journal_lock);
+        }
+    }
+  op_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation begun by journal_begin().  If it was the
+   last operation in a transaction that needs to commit, commits
+   it. */
+void
+journal_end (void) 
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  ASSERT (op_cnt > 0);
+  if (--op_cnt == 0 && commit_wanted)
+    commit ();
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Adds SECTOR, which the current operation has modified for the
+   first time in the running transaction, to the transaction.
+   Called by the buffer cache. */
+void
+journal_add (block_sector_t sector) 
+{
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  if (logged_cnt >= JOURNAL_CAP)
+    PANIC ("journal transaction overflow");
+  logged[logged_cnt++] = sector;
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction, waiting for its operations to
+   end first.  New operations wait until it has committed.  Must
+   not be called within an operation. */
+void
+journal_commit (void) 
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  while (committing || op_cnt > 0) 
+    {
+      if (!committing)
+        commit_wanted = true;
+      cond_wait (&journal_cond, &journal_lock);
+    }
+  commit ();
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction and writes back all cached
+   data, then arranges for the system to crash, as if power had
+   been lost, just before the journal's WRITE_CNT'th following
+   disk write.  Used to test recovery. */
+void
+journal_crash_after (unsigned write_cnt) 
+{
+  journal_commit ();
+  cache_flush ();
+  crash_countdown = write_cnt;
+}
+
+/* Commits the running transaction and writes back all cached
+   data, then arranges for the system to crash in PHASE of the
+   next commit that logs any sectors: halfway through copying
+   them to the log or writing them home, or right after clearing
+   the header.  Unlike journal_crash_after(), the phase hit does
+   not depend on how many sectors the transaction logs.  Used to
+   test recovery. */
+void
+journal_crash_in (enum journal_phase phase) 
+{
+  journal_commit ();
+  cache_flush ();
+  crash_phase = phase;
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void) 
+{
+  printf ("Journal: %lld commits, %lld sectors logged\n",
+          commit_cnt, log_write_cnt);
+}
+
+/* Commits the running transaction, which must have no operations
+   in progress.  journal_lock must be held; it is released while
+   writing to disk. */
+static void
+commit (void) 
+{
+  size_t cnt = logged_cnt;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (op_cnt == 0 && !committing);
+
+  committing = true;
+  commit_wanted = false;
+  lock_release (&journal_lock);
+
+  if (cnt > 0) 
+    {
+      const void *bufs[LOG_BATCH];
+      size_t j, n, run;
+
+      for (j = 0; j < LOG_BATCH; j++)
+        bufs[j] = buffers[j];
+
+      /* Sort the logged sectors by home location, so that those
+         written home below form runs of consecutive sectors.
+         The order of the log does not matter to replay. */
+      for (i = 1; i < cnt; i++) 
+        {
+          block_sector_t sector = logged[i];
+          for (j = i; j > 0 && logged[j - 1] > sector; j--)
+            logged[j] = logged[j - 1];
+          logged[j] = sector;
+        }
+
+      /* Copy the logged sectors into the log, LOG_BATCH at a
+         time. */
+      crash_at_phase (JOURNAL_LOG, cnt);
+      for (i = 0; i < cnt; i += n) 
+        {
+          n = load_batch (i, cnt);
+          journal_write (JOURNAL_SECTOR + 1 + i, n, bufs);
+        }
+      write_header (cnt);
+
+      /* Write them home, a run of consecutive sectors at a
+         time. */
+      crash_at_phase (JOURNAL_HOME, cnt);
+      for (i = 0; i < cnt; i += n) 
+        {
+          n = load_batch (i, cnt);
+          for (j = 0; j < n; j += run) 
+            {
+              for (run = 1; j + run < n; run++)
+                if (logged[i + j + run] != logged[i + j + run - 1] + 1)
+                  break;
+              journal_write (logged[i + j], run, bufs + j);
+            }
+          for (j = 0; j < n; j++)
+            cache_unlog (logged[i + j]);
+        }
+      write_header (0);
+      crash_at_phase (JOURNAL_CLEAR, cnt);
+
+      /* Only now may sectors freed by the transaction be reused. */
+      free_map_commit ();
+    }
+
+  lock_acquire (&journal_lock);
+  logged_cnt = 0;
+  committing = false;
+  if (cnt > 0) 
+    {
+      commit_cnt++;
+      log_write_cnt += cnt;
+    }
+  cond_broadcast (&journal_cond, &journal_lock);
+}
+
+/* Reads the logged sectors starting at index FIRST of the
+   running transaction, up to LOG_BATCH of them but not past index
+   CNT, from the cache into buffers[].  Returns the number read.
+   Logged sectors stay cached until cache_unlog(), and no
+   operation can modify them while a commit is in progress. */
+static size_t
+load_batch (size_t first, size_t cnt) 
+{
+  size_t n = cnt - first < LOG_BATCH ? cnt - first : LOG_BATCH;
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    cache_read (logged[first + i], buffers[i]);
+  return n;
+}
+
+/* Writes a journal header that lists the first CNT sectors of
+   the running transaction as logged. */
+static void
+write_header (size_t cnt) 
+{
+  const void *buf = &header;
+
+  ASSERT (cnt <= JOURNAL_CAP);
+
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.cnt = cnt;
+  memcpy (header.home, logged, cnt * sizeof *logged);
+  journal_write (JOURNAL_SECTOR, 1, &buf);
+}
+
+/* Called by commit() as it enters PHASE of committing CNT
+   sectors.  If a crash is wanted in PHASE, arranges for it to
+   happen halfway through the CNT sectors written in the phase,
+   or at once for JOURNAL_CLEAR, in which nothing is written. */
+static void
+crash_at_phase (enum journal_phase phase, size_t cnt) 
+{
+  if (crash_phase != phase)
+    return;
+
+  crash_phase = JOURNAL_NONE;
+  if (phase == JOURNAL_CLEAR) 
+    {
+      printf ("Journal: crashing after clearing header.\n");
+      shutdown_crash ();
+    }
+  crash_countdown = cnt / 2 + 1;
+}
+
+/* Writes the CNT sectors starting at SECTOR on the file system
+   device from BUFS, unless an injected crash is due first, in
+   which case only the sectors before it are written. */
+static void
+journal_write (block_sector_t sector, size_t cnt,
+               const void *const bufs[]) 
+{
+  if (crash_countdown > 0) 
+    {
+      if (crash_countdown <= cnt) 
+        {
+          block_write_multi (fs_device, sector, crash_countdown - 1,
+                             bufs);
+          printf ("Journal: crashing before writing sector %"PRDSNu".\n",
+                  sector + crash_countdown - 1);
+          shutdown_crash ();
+        }
+      crash_countdown -= cnt;
+    }
+  block_write_multi (fs_device, sector, cnt, bufs);
+}
@@ -0,0 +1,35 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* The journal occupies a header sector at JOURNAL_SECTOR,
+   followed by JOURNAL_CAP sectors for logged metadata.  A
+   transaction's sectors stay in the buffer cache until it
+   commits, so JOURNAL_CAP must leave part of the cache free
+   (see journal_init()). */
+#define JOURNAL_SECTOR 2
+#define JOURNAL_CAP 48
+#define JOURNAL_SECTOR_CNT (1 + JOURNAL_CAP)
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_add (block_sector_t);
+void journal_commit (void);
+
+/* Phases of a commit, for journal_crash_in(). */
+enum journal_phase
+  {
+    JOURNAL_NONE,               /* No phase. */
+    JOURNAL_LOG,                /* Copying sectors to the log. */
+    JOURNAL_HOME,               /* Writing logged sectors home. */
+    JOURNAL_CLEAR               /* Just after clearing the header. */
+  };
+
+void journal_crash_after (unsigned write_cnt);
+void journal_crash_in (enum journal_phase);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -68,6 +68,46 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a bit mask in which the CNT bits starting at bit OFS
+   are set to 1 and the rest are set to 0.  OFS + CNT must not
+   exceed ELEM_BITS, and CNT must be positive. */
+static inline elem_type
+range_mask (size_t ofs, size_t cnt) 
+{
+  elem_type mask = cnt < ELEM_BITS ? ((elem_type) 1 << cnt) - 1 : (elem_type) -1;
+  return mask << ofs;
+}
+
+/* Returns an elem_type to XOR with an element so that the bits
+   set to VALUE become 1 and the others become 0. */
+static inline elem_type
+value_flip (bool value) 
+{
+  return value ? 0 : (elem_type) -1;
+}
+
+/* Returns the number of 1-bits in X.
+   See [Warren], "Hacker's Delight", section 5-1.  We avoid
+   __builtin_popcount(), which may call into libgcc. */
+static inline size_t
+count_ones (elem_type x) 
+{
+  const elem_type ones = (elem_type) -1;
+  x = x - ((x >> 1) & (ones / 3));
+  x = (x & (ones / 15 * 3)) + ((x >> 2) & (ones / 15 * 3));
+  x = (x + (x >> 4)) & (ones / 255 * 15);
+  return (elem_type) (x * (ones / 255)) >> (sizeof x - 1) * CHAR_BIT;
+}
+
+/* Returns the index of the lowest 1-bit in X, which must be
+   nonzero. */
+static inline size_t
+lowest_one (elem_type x) 
+{
+  ASSERT (x != 0);
+  return __builtin_ctzl (x);
+}
 
 /* Creation and destruction. */
 
@@ -213,18 +253,33 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, a whole element at a
+   time. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t end = start + cnt;
   size_t i;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  for (i = start; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < end - i ? ELEM_BITS - ofs : end - i;
+      elem_type mask = range_mask (ofs, n);
+      elem_type *e = &b->bits[elem_idx (i)];
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "=m" (*e) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (*e) : "r" (~mask) : "cc");
+      i += n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,6 +287,8 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  elem_type flip = value_flip (value);
+  size_t end = start + cnt;
   size_t i, value_cnt;
 
   ASSERT (b != NULL);
@@ -239,9 +296,14 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  for (i = start; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < end - i ? ELEM_BITS - ofs : end - i;
+      value_cnt += count_ones ((b->bits[elem_idx (i)] ^ flip)
+                               & range_mask (ofs, n));
+      i += n;
+    }
   return value_cnt;
 }
 
@@ -250,15 +312,22 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  elem_type flip = value_flip (value);
+  size_t end = start + cnt;
   size_t i;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
+  for (i = start; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < end - i ? ELEM_BITS - ofs : end - i;
+      if ((b->bits[elem_idx (i)] ^ flip) & range_mask (ofs, n))
+        return true;
+      i += n;
+    }
   return false;
 }
 
@@ -288,10 +357,43 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+/* Returns the index of the first bit at or after START in B that
+   is set to VALUE, or B's size if there is none. */
+static size_t
+next_bit (const struct bitmap *b, size_t start, bool value) 
+{
+  elem_type flip = value_flip (value);
+  size_t last_idx = elem_cnt (b->bit_cnt);
+  size_t idx, bit;
+  elem_type e;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  /* Examine a whole element at a time, ignoring the bits in the
+     first element that precede START. */
+  idx = elem_idx (start);
+  e = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (e == 0)
+    {
+      if (++idx >= last_idx)
+        return b->bit_cnt;
+      e = b->bits[idx] ^ flip;
+    }
+
+  bit = idx * ELEM_BITS + lowest_one (e);
+  return bit < b->bit_cnt ? bit : b->bit_cnt;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Rather than testing every possible starting bit, this skips
+   from one run of VALUE bits to the next, a word at a time, so
+   it takes time proportional to the number of words scanned
+   plus the number of runs too short to qualify. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
@@ -301,10 +403,22 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      if (cnt == 0)
+        return start <= last ? start : BITMAP_ERROR;
+      while (i <= last)
+        {
+          size_t run_start = next_bit (b, i, value);
+          size_t run_end;
+
+          if (run_start > last)
+            break;
+          run_end = next_bit (b, run_start, !value);
+          if (run_end - run_start >= cnt)
+            return run_start;
+          i = run_end;
+        }
     }
   return BITMAP_ERROR;
 }
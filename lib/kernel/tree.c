@@ -0,0 +1,252 @@
+#include "tree.h"
+#include <debug.h>
+
+/* An AA tree keeps the following invariants, where a null child
+   has level 0:
+
+     - A left child's level is one less than its parent's.
+     - A right child's level is equal to or one less than its
+       parent's.
+     - A right grandchild's level is less than its grandparent's.
+     - Every node above level 1 has two children.
+
+   See A. Andersson, "Balanced Search Trees Made Simple",
+   Workshop on Algorithms and Data Structures, 1993. */
+
+static struct tree_elem *insert (struct tree *, struct tree_elem *t,
+                                 struct tree_elem *e);
+static struct tree_elem *delete (struct tree *, struct tree_elem *t,
+                                 struct tree_elem *e);
+static void clear (struct tree *, struct tree_elem *, tree_action_func *);
+
+/* Initializes tree T to use LESS to order its elements, given
+   auxiliary data AUX. */
+void
+tree_init (struct tree *t, tree_less_func *less, void *aux) 
+{
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Removes all the elements from T.
+
+   If DESTRUCTOR is non-null, then it is called for each element
+   in the tree.  DESTRUCTOR may, if appropriate, deallocate the
+   memory used by the element.  However, modifying tree T while
+   tree_clear() is running, using any of the functions
+   tree_clear(), tree_insert(), or tree_delete(), yields
+   undefined behavior, whether done in DESTRUCTOR or elsewhere. */
+void
+tree_clear (struct tree *t, tree_action_func *destructor) 
+{
+  clear (t, t->root, destructor);
+  t->root = NULL;
+  t->elem_cnt = 0;
+}
+
+/* Inserts E into T.  No element equal to E may already be in
+   T. */
+void
+tree_insert (struct tree *t, struct tree_elem *e) 
+{
+  t->root = insert (t, t->root, e);
+  t->elem_cnt++;
+}
+
+/* Removes E, which must be in T, from T. */
+void
+tree_delete (struct tree *t, struct tree_elem *e) 
+{
+  ASSERT (t->elem_cnt > 0);
+  t->root = delete (t, t->root, e);
+  t->elem_cnt--;
+}
+
+/* Returns the least element in T that is not less than PROBE,
+   or a null pointer if there is no such element.  PROBE need not
+   be in T. */
+struct tree_elem *
+tree_ceil (struct tree *t, const struct tree_elem *probe) 
+{
+  struct tree_elem *e = t->root;
+  struct tree_elem *best = NULL;
+
+  while (e != NULL)
+    if (t->less (e, probe, t->aux))
+      e = e->right;
+    else 
+      {
+        best = e;
+        e = e->left;
+      }
+  return best;
+}
+
+/* Returns the greatest element in T that is not greater than
+   PROBE, or a null pointer if there is no such element.  PROBE
+   need not be in T. */
+struct tree_elem *
+tree_floor (struct tree *t, const struct tree_elem *probe) 
+{
+  struct tree_elem *e = t->root;
+  struct tree_elem *best = NULL;
+
+  while (e != NULL)
+    if (t->less (probe, e, t->aux))
+      e = e->left;
+    else 
+      {
+        best = e;
+        e = e->right;
+      }
+  return best;
+}
+
+/* Returns the number of elements in T. */
+size_t
+tree_size (struct tree *t) 
+{
+  return t->elem_cnt;
+}
+
+/* Returns true if T contains no elements, false otherwise. */
+bool
+tree_empty (struct tree *t) 
+{
+  return t->elem_cnt == 0;
+}
+
+/* Returns the level of E, which may be null. */
+static inline int
+level (const struct tree_elem *e) 
+{
+  return e != NULL ? e->level : 0;
+}
+
+/* Removes a left horizontal link below E by rotating right.
+   Returns the new root of the subtree. */
+static struct tree_elem *
+skew (struct tree_elem *e) 
+{
+  if (e != NULL && level (e->left) == e->level) 
+    {
+      struct tree_elem *l = e->left;
+      e->left = l->right;
+      l->right = e;
+      return l;
+    }
+  return e;
+}
+
+/* Removes two consecutive right horizontal links below E by
+   rotating left and promoting the middle element.  Returns the
+   new root of the subtree. */
+static struct tree_elem *
+split (struct tree_elem *e) 
+{
+  if (e != NULL && e->right != NULL && level (e->right->right) == e->level) 
+    {
+      struct tree_elem *r = e->right;
+      e->right = r->left;
+      r->left = e;
+      r->level++;
+      return r;
+    }
+  return e;
+}
+
+/* Inserts E into the subtree rooted at S in T, and returns the
+   new root of the subtree. */
+static struct tree_elem *
+insert (struct tree *t, struct tree_elem *s, struct tree_elem *e) 
+{
+  if (s == NULL) 
+    {
+      e->left = e->right = NULL;
+      e->level = 1;
+      return e;
+    }
+
+  if (t->less (e, s, t->aux))
+    s->left = insert (t, s->left, e);
+  else
+    s->right = insert (t, s->right, e);
+  return split (skew (s));
+}
+
+/* Removes E from the subtree rooted at S in T, and returns the
+   new root of the subtree. */
+static struct tree_elem *
+delete (struct tree *t, struct tree_elem *s, struct tree_elem *e) 
+{
+  int should_be;
+
+  ASSERT (s != NULL);
+
+  if (t->less (e, s, t->aux))
+    s->left = delete (t, s->left, e);
+  else if (t->less (s, e, t->aux))
+    s->right = delete (t, s->right, e);
+  else 
+    {
+      struct tree_elem *r;
+
+      ASSERT (s == e);
+      if (s->left == NULL && s->right == NULL)
+        return NULL;
+
+      /* Replace S by its in-order neighbor, which is always at
+         level 1, after removing that neighbor from below. */
+      if (s->left == NULL) 
+        {
+          for (r = s->right; r->left != NULL; r = r->left)
+            continue;
+          s->right = delete (t, s->right, r);
+        }
+      else 
+        {
+          for (r = s->left; r->right != NULL; r = r->right)
+            continue;
+          s->left = delete (t, s->left, r);
+        }
+      r->left = s->left;
+      r->right = s->right;
+      r->level = s->level;
+      s = r;
+    }
+
+  /* Rebalance. */
+  should_be = (level (s->left) < level (s->right)
+               ? level (s->left) : level (s->right)) + 1;
+  if (should_be < s->level) 
+    {
+      s->level = should_be;
+      if (should_be < level (s->right))
+        s->right->level = should_be;
+    }
+  s = skew (s);
+  s->right = skew (s->right);
+  if (s->right != NULL)
+    s->right->right = skew (s->right->right);
+  s = split (s);
+  s->right = split (s->right);
+  return s;
+}
+
+/* Calls DESTRUCTOR, if non-null, on every element of the
+   subtree rooted at S in T, visiting children before parents. */
+static void
+clear (struct tree *t, struct tree_elem *s, tree_action_func *destructor) 
+{
+  if (s != NULL) 
+    {
+      struct tree_elem *left = s->left;
+      struct tree_elem *right = s->right;
+      clear (t, left, destructor);
+      clear (t, right, destructor);
+      if (destructor != NULL)
+        destructor (s, t->aux);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef __LIB_KERNEL_TREE_H
+#define __LIB_KERNEL_TREE_H
+
+/* Balanced binary search tree.
+
+   This is an AA tree, a simplified variant of the red-black
+   tree, so insertion, deletion, and search all take O(lg n)
+   time in the worst case.
+
+   Like lists and hash tables, trees do not use dynamic
+   allocation.  Each structure that can potentially be in a tree
+   must embed a struct tree_elem member, and the tree_entry macro
+   converts a struct tree_elem back to the structure that
+   contains it.  Refer to lib/kernel/list.h for a detailed
+   explanation of this technique.
+
+   Elements are ordered by a caller-supplied "less" function.
+   No two elements in a tree may compare equal, so a less
+   function usually breaks ties between otherwise equal keys by
+   comparing some other, unique field. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree element. */
+struct tree_elem 
+  {
+    struct tree_elem *left;     /* Left child, or null. */
+    struct tree_elem *right;    /* Right child, or null. */
+    int level;                  /* Level in the AA tree, at least 1. */
+  };
+
+/* Converts pointer to tree element TREE_ELEM into a pointer to
+   the structure that TREE_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the tree element. */
+#define tree_entry(TREE_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) &(TREE_ELEM)->left     \
+                     - offsetof (STRUCT, MEMBER.left)))
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool tree_less_func (const struct tree_elem *a,
+                             const struct tree_elem *b,
+                             void *aux);
+
+/* Performs some operation on tree element E, given auxiliary
+   data AUX. */
+typedef void tree_action_func (struct tree_elem *e, void *aux);
+
+/* Tree. */
+struct tree 
+  {
+    struct tree_elem *root;     /* Root element, or null if empty. */
+    size_t elem_cnt;            /* Number of elements in tree. */
+    tree_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+/* Basic life cycle. */
+void tree_init (struct tree *, tree_less_func *, void *aux);
+void tree_clear (struct tree *, tree_action_func *);
+
+/* Insertion and deletion. */
+void tree_insert (struct tree *, struct tree_elem *);
+void tree_delete (struct tree *, struct tree_elem *);
+
+/* Search. */
+struct tree_elem *tree_ceil (struct tree *, const struct tree_elem *);
+struct tree_elem *tree_floor (struct tree *, const struct tree_elem *);
+
+/* Information. */
+size_t tree_size (struct tree *);
+bool tree_empty (struct tree *);
+
+#endif /* lib/kernel/tree.h */
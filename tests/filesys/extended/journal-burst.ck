@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-burst) begin
+(journal-burst) creating 100 files
+(journal-burst) opening 100 files
+(journal-burst) end
+EOF
+pass;
@@ -0,0 +1,4 @@
+/* Crashes right after a transaction has been written home and
+   the journal header cleared, so that nothing is replayed. */
+
+#include "tests/filesys/extended/journal-crash.inc"
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::filesys::extended::journal;
+check_journal_crash (qr/Journal: crashing after clearing header\./);
@@ -0,0 +1,4 @@
+/* Crashes halfway through writing a committed transaction's
+   sectors home, so that the rest must be replayed at boot. */
+
+#include "tests/filesys/extended/journal-crash.inc"
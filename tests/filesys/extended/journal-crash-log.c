@@ -0,0 +1,4 @@
+/* Crashes halfway through copying a transaction to the log,
+   before its commit point, so that none of it is replayed. */
+
+#include "tests/filesys/extended/journal-crash.inc"
@@ -0,0 +1,5 @@
+/* Crashes at a fixed journal write, after the sectors logged by
+   the test have been copied to the log but before all of them
+   have been written home. */
+
+#include "tests/filesys/extended/journal-crash.inc"
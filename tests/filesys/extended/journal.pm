@@ -0,0 +1,52 @@
+# check_journal_crash ($MESSAGE)
+#
+# Checks that the run crashed where intended, as reported by a
+# kernel message matching regular expression $MESSAGE.
+sub check_journal_crash {
+    my ($message) = @_;
+    our ($test);
+
+    my (@output) = read_text_file ("$test.output");
+    check_for_panic ("run", @output);
+    check_for_triple_fault ("run", @output);
+    fail "Run didn't start up properly: no \"Boot complete\" message\n"
+      if !grep (/Boot complete/, @output);
+    fail "Run didn't crash where expected: no \"Journal: crashing\" "
+      . "message\n"
+      if !grep (/$message/, @output);
+    pass;
+}
+
+# check_journal_persistence ($REPLAYED)
+#
+# Checks that the file system extracted after a crash in the
+# middle of journal-crash.inc's changes is in one of the states
+# that they pass through.  If $REPLAYED is defined, also checks
+# that the journal was replayed at boot if it is true, or that it
+# was not if it is false.
+sub check_journal_persistence {
+    my ($replayed) = @_;
+    our ($test);
+
+    if (defined $replayed) {
+	my (@output) = read_text_file ("$test.output");
+	my ($did_replay) = grep (/Journal: replayed \d+ sectors\./, @output);
+	fail "Journal was not replayed after crash.\n"
+	  if $replayed && !$did_replay;
+	fail "Journal was replayed after crash, but nothing was "
+	  . "committed.\n"
+	  if !$replayed && $did_replay;
+    }
+
+    my ($zeros) = ["\0" x 1000];
+    check_archive_any ({},
+		       {'a' => {}},
+		       {'a' => {'b' => $zeros}},
+		       {'a' => {'b' => $zeros, 'c' => {}}},
+		       {'a' => {'b' => $zeros, 'c' => {'d' => [""]}}},
+		       {'a' => {'c' => {'d' => [""]}}},
+		       {'a' => {'c' => {'d' => [""]}}, 'e' => {}});
+    pass;
+}
+
+1;
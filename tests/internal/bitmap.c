@@ -0,0 +1,176 @@
+/* Test program and microbenchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_count(), bitmap_contains(), bitmap_scan(), and
+   bitmap_set_multiple() against straightforward bit-at-a-time
+   versions of the same functions, then times both versions on
+   maps of BIT_CNT bits.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+#include "devices/timer.h"
+
+/* Number of bits in the benchmark maps. */
+#define BIT_CNT (1024 * 1024)
+
+/* Number of random queries to check for correctness. */
+#define CHECK_CNT 2000
+
+static void fill (struct bitmap *, int density);
+static void check (struct bitmap *);
+static void benchmark (struct bitmap *, const char *name);
+static size_t slow_count (const struct bitmap *, size_t start, size_t cnt,
+                          bool);
+static bool slow_contains (const struct bitmap *, size_t start, size_t cnt,
+                           bool);
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool);
+
+/* Test and time the bitmap implementation. */
+void
+test (void) 
+{
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  ASSERT (b != NULL);
+
+  printf ("checking bitmaps against bit-at-a-time versions...");
+  fill (b, 2);
+  check (b);
+  fill (b, 50);
+  check (b);
+  printf (" done\n");
+
+  /* A map that is almost full, like a busy free map, makes the
+     old bitmap_scan() test nearly every starting bit. */
+  fill (b, 95);
+  benchmark (b, "95% full");
+  fill (b, 50);
+  benchmark (b, "50% full");
+
+  bitmap_destroy (b);
+}
+
+/* Sets about DENSITY percent of the bits in B, at random. */
+static void
+fill (struct bitmap *b, int density) 
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 100) < density);
+}
+
+/* Compares the word-at-a-time functions against the slow
+   versions on random ranges of B. */
+static void
+check (struct bitmap *b) 
+{
+  size_t size = bitmap_size (b);
+  int i;
+
+  for (i = 0; i < CHECK_CNT; i++) 
+    {
+      size_t start = random_ulong () % size;
+      size_t cnt = random_ulong () % (size - start < 4096
+                                      ? size - start : 4096);
+      bool value = random_ulong () % 2;
+      size_t run = random_ulong () % 16;
+
+      ASSERT (bitmap_count (b, start, cnt, value)
+              == slow_count (b, start, cnt, value));
+      ASSERT (bitmap_contains (b, start, cnt, value)
+              == slow_contains (b, start, cnt, value));
+      ASSERT (bitmap_scan (b, start, run, value)
+              == slow_scan (b, start, run, value));
+
+      if (i % 16 == 0) 
+        {
+          size_t j;
+
+          bitmap_set_multiple (b, start, cnt, value);
+          for (j = start; j < start + cnt; j++)
+            ASSERT (bitmap_test (b, j) == value);
+        }
+    }
+}
+
+/* Prints the time taken by the fast and slow versions of
+   counting the bits in B and of scanning it for runs. */
+static void
+benchmark (struct bitmap *b, const char *name) 
+{
+  size_t size = bitmap_size (b);
+  int64_t start, fast, slow;
+  size_t run;
+
+  printf ("%s map of %zu bits:\n", name, size);
+
+  start = timer_ns ();
+  bitmap_count (b, 0, size, true);
+  fast = timer_ns () - start;
+  start = timer_ns ();
+  slow_count (b, 0, size, true);
+  slow = timer_ns () - start;
+  printf ("  count:        %8lld us word-at-a-time, %8lld us bitwise\n",
+          fast / 1000, slow / 1000);
+
+  for (run = 1; run <= 64; run *= 8) 
+    {
+      start = timer_ns ();
+      bitmap_scan (b, 0, run, false);
+      fast = timer_ns () - start;
+      start = timer_ns ();
+      slow_scan (b, 0, run, false);
+      slow = timer_ns () - start;
+      printf ("  scan for %2zu: %8lld us word-at-a-time, %8lld us bitwise\n",
+              run, fast / 1000, slow / 1000);
+    }
+}
+
+/* Bit-at-a-time version of bitmap_count(). */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Bit-at-a-time version of bitmap_contains(). */
+static bool
+slow_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      return true;
+  return false;
+}
+
+/* Bit-at-a-time version of bitmap_scan(), which tries every
+   starting bit in turn. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  if (cnt <= bitmap_size (b)) 
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+
+      for (i = start; i <= last; i++)
+        if (!slow_contains (b, i, cnt, !value))
+          return i;
+    }
+  return BITMAP_ERROR;
+}
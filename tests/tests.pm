@@ -313,6 +313,46 @@ EOF
     fail "Extracted file system contents are not correct.\n" if $errors;
 }
 
+# check_archive_any (@HIER_FS)
+#
+# Like check_archive(), but accepts any one of the file systems in
+# @HIER_FS.  Used by tests that crash the kernel partway through,
+# after which the file system may be in any of several consistent
+# states.  The expected file system is chosen by matching names,
+# types, and file sizes, then checked in full by check_archive().
+sub check_archive_any {
+    my (@hier_fs) = @_;
+
+    my ($test_base_name) = $test;
+    $test_base_name =~ s%.*/%%;
+    $test_base_name =~ s%-persistence$%%;
+
+    my (%actual) = read_tar ("$prereq_tests[0].tar");
+    my ($actual_sig) = fs_signature (%actual);
+    foreach my $hier_fs (@hier_fs) {
+	my (%hier) = (%$hier_fs,
+		      $test_base_name => $prereq_tests[0],
+		      'tar' => 'tests/filesys/extended/tar');
+	my (%expected) = normalize_fs (flatten_hierarchy (\%hier, ""));
+	return check_archive ($hier_fs)
+	  if fs_signature (%expected) eq $actual_sig;
+    }
+    print "File system is not in any of the expected states.\n";
+    check_archive ($hier_fs[$#hier_fs]);
+}
+
+# fs_signature (%FS)
+#
+# Returns a string that describes the names, types, and sizes of
+# the files in %FS, which must be a file system as flattened by
+# flatten_hierarchy() and normalized by normalize_fs().
+sub fs_signature {
+    my (%fs) = @_;
+    return join ("\n", map (is_dir ($fs{$_})
+			     ? "$_/" : "$_ " . file_size ($fs{$_}),
+			     sort keys %fs));
+}
+
 # open_file ([$FILE, $OFFSET, $LENGTH])
 # open_file ([$CONTENTS])
 #
@@ -0,0 +1,99 @@
+/* Arms 10,000 timeouts with delays spread over a few seconds,
+   cancels every third one, and verifies that each remaining
+   timeout fires exactly once, on exactly the tick it was armed
+   for, and that no cancelled timeout fires.  The delays span
+   several wraparounds of the timing wheel's lowest level, so
+   timeouts are cascaded between levels along the way. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of timeouts to arm. */
+#define TIMEOUT_CNT 10000
+
+/* Longest delay, in ticks. */
+#define DELAY_MAX 300
+
+/* One timeout under test. */
+struct wheel_test
+  {
+    struct timeout timeout;     /* The timeout. */
+    int64_t expected;           /* Tick it should fire at. */
+    int64_t fired;              /* Tick it last fired at. */
+    int fire_cnt;               /* Number of times it fired. */
+    bool cancelled;             /* Cancelled before firing? */
+  };
+
+static timeout_func record_fire;
+
+void
+test_alarm_wheel (void) 
+{
+  struct wheel_test *tests;
+  int64_t last_expected = 0;
+  int i;
+
+  tests = malloc (sizeof *tests * TIMEOUT_CNT);
+  if (tests == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  msg ("Arming %d timeouts.", TIMEOUT_CNT);
+  for (i = 0; i < TIMEOUT_CNT; i++)
+    {
+      struct wheel_test *t = &tests[i];
+      int64_t delay = i * 7919 % DELAY_MAX + 1;
+      enum intr_level old_level;
+
+      timeout_init (&t->timeout, record_fire, t);
+      t->fired = -1;
+      t->fire_cnt = 0;
+      t->cancelled = false;
+
+      /* Read the time and arm within the same tick. */
+      old_level = intr_disable ();
+      t->expected = timer_ticks () + delay;
+      timeout_arm (&t->timeout, delay);
+      intr_set_level (old_level);
+
+      if (t->expected > last_expected)
+        last_expected = t->expected;
+    }
+
+  msg ("Cancelling every third timeout.");
+  for (i = 0; i < TIMEOUT_CNT; i += 3)
+    tests[i].cancelled = timeout_cancel (&tests[i].timeout);
+
+  msg ("Waiting for the rest to fire.");
+  while (timer_ticks () <= last_expected)
+    timer_sleep (last_expected - timer_ticks () + 1);
+
+  for (i = 0; i < TIMEOUT_CNT; i++)
+    {
+      struct wheel_test *t = &tests[i];
+
+      if (t->cancelled && t->fire_cnt != 0)
+        fail ("cancelled timeout %d fired at tick %lld",
+              i, (long long) t->fired);
+      else if (!t->cancelled && t->fire_cnt != 1)
+        fail ("timeout %d fired %d times", i, t->fire_cnt);
+      else if (!t->cancelled && t->fired != t->expected)
+        fail ("timeout %d fired at tick %lld, expected %lld",
+              i, (long long) t->fired, (long long) t->expected);
+    }
+  free (tests);
+  pass ();
+}
+
+/* Timeout function: records the tick at which T fired. */
+static void
+record_fire (void *t_) 
+{
+  struct wheel_test *t = t_;
+
+  t->fired = timer_ticks ();
+  t->fire_cnt++;
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-wheel) begin
+(alarm-wheel) Arming 10000 timeouts.
+(alarm-wheel) Cancelling every third timeout.
+(alarm-wheel) Waiting for the rest to fire.
+(alarm-wheel) PASS
+(alarm-wheel) end
+EOF
+pass;
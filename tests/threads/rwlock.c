@@ -0,0 +1,51 @@
+/* Tests that readers share a readers-writer lock, that a writer
+   waits for the readers holding it, and that a reader arriving
+   while a writer waits does not get ahead of the writer. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func reader_thread;
+static thread_func writer_thread;
+static struct rwlock rw;
+
+void
+test_rwlock (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rw);
+  rwlock_acquire_read (&rw);
+  msg ("Main thread acquired read lock.");
+
+  thread_create ("reader 1", PRI_DEFAULT + 1, reader_thread, NULL);
+  thread_create ("writer", PRI_DEFAULT + 1, writer_thread, NULL);
+  thread_create ("reader 2", PRI_DEFAULT + 2, reader_thread, NULL);
+
+  msg ("Main thread releasing read lock.");
+  rwlock_release_read (&rw);
+  msg ("Main thread finished.");
+}
+
+static void
+reader_thread (void *aux UNUSED) 
+{
+  rwlock_acquire_read (&rw);
+  msg ("Thread %s acquired read lock.", thread_name ());
+  rwlock_release_read (&rw);
+}
+
+static void
+writer_thread (void *aux UNUSED) 
+{
+  rwlock_acquire_write (&rw);
+  msg ("Thread %s acquired write lock.", thread_name ());
+  rwlock_release_write (&rw);
+}
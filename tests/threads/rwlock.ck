@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock) begin
+(rwlock) Main thread acquired read lock.
+(rwlock) Thread reader 1 acquired read lock.
+(rwlock) Main thread releasing read lock.
+(rwlock) Thread writer acquired write lock.
+(rwlock) Thread reader 2 acquired read lock.
+(rwlock) Main thread finished.
+(rwlock) end
+EOF
+pass;
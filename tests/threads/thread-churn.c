@@ -0,0 +1,47 @@
+/* Creates and destroys many short-lived threads, one at a time,
+   and reports the average time taken per create/exit pair.  Each
+   thread has a higher priority than the creator, so it runs and
+   exits before thread_create() returns, and its page is
+   recycled by the next thread_create() call. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of threads to create. */
+#define THREAD_CNT 1000
+
+static thread_func churn_thread;
+
+void
+test_thread_churn (void) 
+{
+  int64_t start, elapsed;
+  int run_cnt = 0;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Creating %d threads.", THREAD_CNT);
+  start = timer_ns ();
+  for (i = 0; i < THREAD_CNT; i++)
+    if (thread_create ("churn", PRI_DEFAULT + 1, churn_thread, &run_cnt)
+        == TID_ERROR)
+      fail ("thread_create failed after %d threads", i);
+  elapsed = timer_ns () - start;
+
+  if (run_cnt != THREAD_CNT)
+    fail ("only %d of %d threads ran", run_cnt, THREAD_CNT);
+  msg ("All %d threads ran.", THREAD_CNT);
+  msg ("%lld ns per create/exit pair.", elapsed / THREAD_CNT);
+}
+
+static void 
+churn_thread (void *run_cnt_) 
+{
+  int *run_cnt = run_cnt_;
+  (*run_cnt)++;
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# The timing varies from run to run, so accept any value.
+my (@expected) = ("(thread-churn) begin",
+		  "(thread-churn) Creating 1000 threads.",
+		  "(thread-churn) All 1000 threads ran.",
+		  qr/^\(thread-churn\) \d+ ns per create\/exit pair\.$/,
+		  "(thread-churn) end");
+fail "Expected " . @expected . " lines of output, got " . @output . ".\n"
+  if @output != @expected;
+for my $i (0...$#expected) {
+    my ($ok) = ref ($expected[$i])
+      ? $output[$i] =~ $expected[$i] : $output[$i] eq $expected[$i];
+    fail "Unexpected output line: $output[$i]\n" if !$ok;
+}
+pass;
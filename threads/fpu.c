@@ -0,0 +1,241 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Lazy floating-point context switching.
+
+   The kernel itself is compiled with -msoft-float and never
+   touches the FPU, so only user programs have floating-point
+   state, and most of them never use it.  Instead of saving and
+   restoring that state on every context switch, we leave it in
+   the FPU registers and set CR0.TS whenever a thread other than
+   its owner runs.  The first FPU or SSE instruction that thread
+   executes then raises #NM (Device Not Available), and only at
+   that point do we save the owner's state and load the new
+   thread's.  A thread gets a save area the first time it uses
+   the FPU; threads that never do cost nothing beyond a CR0
+   write on some switches.
+
+   See [IA32-v3a] 2.5 "Control Registers" and 12.5 "Providing
+   Non-Numeric Exception Handlers for Exception Handlers". */
+
+/* CR0 bits. */
+#define CR0_MP 0x00000002       /* Monitor coprocessor. */
+#define CR0_EM 0x00000004       /* (Floating-point) Emulation. */
+#define CR0_TS 0x00000008       /* Task Switched. */
+#define CR0_NE 0x00000020       /* Numeric Error reporting by #MF. */
+
+/* CR4 bits. */
+#define CR4_OSFXSR 0x00000200     /* FXSAVE/FXRSTOR save SSE state. */
+#define CR4_OSXMMEXCPT 0x00000400 /* Unmasked SSE exceptions raise #XF. */
+
+/* Save area sizes for FXSAVE and, on CPUs without it, FNSAVE. */
+#define FXSAVE_SIZE 512
+#define FNSAVE_SIZE 108
+
+/* Alignment required by FXSAVE. */
+#define FPU_ALIGN 16
+
+/* Power-on value of MXCSR: all SSE exceptions masked. */
+#define MXCSR_DEFAULT 0x1f80
+
+/* True if the CPU supports FXSAVE/FXRSTOR. */
+static bool have_fxsr;
+
+/* Thread whose state is currently in the FPU registers, or a
+   null pointer if none. */
+static struct thread *fpu_owner;
+
+/* FPU state of a thread that has just started using it. */
+static uint8_t initial_state[FXSAVE_SIZE] __attribute__ ((aligned (FPU_ALIGN)));
+
+/* Statistics. */
+static long long first_use_cnt; /* # of save areas allocated. */
+static long long restore_cnt;   /* # of times state was loaded. */
+
+static void fpu_trap (struct intr_frame *);
+static void *save_area (struct thread *);
+static void save (void *);
+static void restore (const void *);
+
+/* Reads CR0. */
+static inline uint32_t
+read_cr0 (void)
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+/* Writes CR0. */
+static inline void
+write_cr0 (uint32_t cr0)
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+/* Enables the FPU, sets up lazy switching, and registers the
+   #NM handler.  start.S left CR0.EM set, which makes every FPU
+   instruction trap; we clear it and arm CR0.TS instead. */
+void
+fpu_init (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  /* CPUID leaf 1 reports FXSR in bit 24 of EDX.  See [IA32-v2a]
+     "CPUID". */
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  have_fxsr = (edx & (1 << 24)) != 0;
+  if (have_fxsr)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
+
+  /* Capture a freshly initialized state to copy into each new
+     save area. */
+  write_cr0 ((read_cr0 () & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+  asm volatile ("fninit");
+  if (have_fxsr)
+    {
+      uint32_t mxcsr = MXCSR_DEFAULT;
+      asm volatile ("ldmxcsr %0" : : "m" (mxcsr));
+    }
+  save (initial_state);
+  write_cr0 (read_cr0 () | CR0_TS);
+
+  intr_register_int (7, 0, INTR_ON, fpu_trap,
+                     "#NM Device Not Available Exception");
+}
+
+/* Called by the scheduler, with interrupts off, just after
+   switching to thread T.  Lets T use the FPU without a trap if
+   its state is still loaded, and otherwise arranges for its
+   first FPU instruction to raise #NM. */
+void
+fpu_switch (struct thread *t)
+{
+  uint32_t cr0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  cr0 = read_cr0 ();
+  if (t == fpu_owner)
+    {
+      if (cr0 & CR0_TS)
+        asm volatile ("clts");
+    }
+  else if (!(cr0 & CR0_TS))
+    write_cr0 (cr0 | CR0_TS);
+}
+
+/* Releases the running thread's FPU state, if any.  Called when
+   the thread exits. */
+void
+fpu_exit (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  void *area;
+
+  old_level = intr_disable ();
+  if (fpu_owner == cur)
+    fpu_owner = NULL;
+  area = cur->fpu_area;
+  cur->fpu_area = NULL;
+  intr_set_level (old_level);
+
+  free (area);
+}
+
+/* Prints FPU statistics. */
+void
+fpu_print_stats (void)
+{
+  printf ("FPU: %lld threads used the FPU, %lld lazy restores\n",
+          first_use_cnt, restore_cnt);
+}
+
+/* #NM handler.  Loads the running thread's FPU state, first
+   saving that of the previous owner. */
+static void
+fpu_trap (struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (f->cs == SEL_KCSEG)
+    {
+      intr_dump_frame (f);
+      PANIC ("Kernel bug - FPU used in kernel");
+    }
+
+  /* Allocate a save area for a first-time user.  This may
+     sleep, so it happens before we turn off interrupts. */
+  if (cur->fpu_area == NULL)
+    {
+      void *area = malloc (FXSAVE_SIZE + FPU_ALIGN - 1);
+      if (area == NULL)
+        {
+          printf ("%s: dying due to interrupt %#04x (%s).\n",
+                  thread_name (), f->vec_no, intr_name (f->vec_no));
+          thread_exit ();
+        }
+      cur->fpu_area = area;
+      memcpy (save_area (cur), initial_state, FXSAVE_SIZE);
+      first_use_cnt++;
+    }
+
+  /* The registers must not change owner while we move state in
+     and out of them. */
+  old_level = intr_disable ();
+  asm volatile ("clts");
+  if (fpu_owner != cur)
+    {
+      if (fpu_owner != NULL)
+        save (save_area (fpu_owner));
+      restore (save_area (cur));
+      fpu_owner = cur;
+      restore_cnt++;
+    }
+  intr_set_level (old_level);
+}
+
+/* Returns T's suitably aligned FPU save area. */
+static void *
+save_area (struct thread *t)
+{
+  return (void *) ROUND_UP ((uintptr_t) t->fpu_area, FPU_ALIGN);
+}
+
+/* Saves the FPU state into AREA. */
+static void
+save (void *area)
+{
+  if (have_fxsr)
+    asm volatile ("fxsave %0" : "=m" (*(uint8_t (*)[FXSAVE_SIZE]) area));
+  else
+    asm volatile ("fnsave %0" : "=m" (*(uint8_t (*)[FNSAVE_SIZE]) area));
+}
+
+/* Loads the FPU state from AREA. */
+static void
+restore (const void *area)
+{
+  if (have_fxsr)
+    asm volatile ("fxrstor %0"
+                  : : "m" (*(const uint8_t (*)[FXSAVE_SIZE]) area));
+  else
+    asm volatile ("frstor %0"
+                  : : "m" (*(const uint8_t (*)[FNSAVE_SIZE]) area));
+}
@@ -15,6 +15,7 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -36,6 +37,7 @@
 #include "devices/ide.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/journal.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -49,6 +51,12 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -fs-crash: Number of journal writes after which to simulate a
+   crash while running the task, or 0 for none, or the phase of a
+   journal commit in which to crash instead. */
+static unsigned fs_crash_writes;
+static enum journal_phase fs_crash_phase;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -63,6 +71,10 @@ static void paging_init (void);
 static char **read_command_line (void);
 static char **parse_options (char **argv);
 static void run_actions (char **argv);
+static void report_thread_stats (char **argv);
+#ifdef FILESYS
+static void report_block_trace (char **argv);
+#endif
 static void usage (void);
 
 #ifdef FILESYS
@@ -107,6 +119,7 @@ main (void)
 
   /* Initialize interrupt handlers. */
   intr_init ();
+  fpu_init ();
   timer_init ();
   kbd_init ();
   input_init ();
@@ -247,6 +260,17 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-fs-crash")) 
+        {
+          if (!strcmp (value, "log"))
+            fs_crash_phase = JOURNAL_LOG;
+          else if (!strcmp (value, "home"))
+            fs_crash_phase = JOURNAL_HOME;
+          else if (!strcmp (value, "clear"))
+            fs_crash_phase = JOURNAL_CLEAR;
+          else
+            fs_crash_writes = atoi (value);
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -256,6 +280,8 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -284,6 +310,12 @@ run_task (char **argv)
   const char *task = argv[1];
   
   printf ("Executing '%s':\n", task);
+#ifdef FILESYS
+  if (fs_crash_writes > 0)
+    journal_crash_after (fs_crash_writes);
+  else if (fs_crash_phase != JOURNAL_NONE)
+    journal_crash_in (fs_crash_phase);
+#endif
 #ifdef USERPROG
   process_wait (process_execute (task));
 #else
@@ -309,12 +341,14 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+      {"threadstats", 1, report_thread_stats},
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"blktrace", 1, report_block_trace},
 #endif
       {NULL, 0, NULL},
     };
@@ -343,6 +377,24 @@ run_actions (char **argv)
   
 }
 
+/* Arranges for per-thread scheduler statistics to be printed
+   at shutdown. */
+static void
+report_thread_stats (char **argv UNUSED)
+{
+  thread_report_stats = true;
+}
+
+#ifdef FILESYS
+/* Arranges for block requests to be traced and for the trace and
+   block latency histograms to be printed at shutdown. */
+static void
+report_block_trace (char **argv UNUSED)
+{
+  block_trace = true;
+}
+#endif
+
 /* Prints a kernel command line help message and powers off the
    machine. */
 static void
@@ -357,10 +409,12 @@ usage (void)
 #else
           "  run TEST           Run TEST.\n"
 #endif
+          "  threadstats        Print per-thread scheduler stats at shutdown.\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  blktrace           Print block I/O latencies, trace at shutdown.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -373,12 +427,15 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -fs-crash=N        Crash at Nth journal write while running.\n"
+          "  -fs-crash=PHASE    Crash in PHASE (log, home, clear) of commit.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the periodic timer interrupt when idle.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
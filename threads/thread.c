@@ -5,12 +5,14 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -21,9 +23,19 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queues of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO queue per priority level. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+static struct list ready_queues[PRI_CNT];
+
+/* Bit P is set if and only if ready_queues[P] is nonempty, so
+   the highest-priority ready thread can be found without
+   scanning the queues. */
+static uint64_t ready_mask;
+
+/* Number of threads in ready_queues. */
+static size_t ready_cnt;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -50,6 +62,42 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static long long avoided_wakeups; /* # of sleeper wakeups not needed. */
+
+/* If true, print per-thread scheduler statistics and the wakeup
+   latency histogram at shutdown.  Controlled by kernel
+   command-line action "threadstats". */
+bool thread_report_stats;
+
+/* Histogram of the time from thread_unblock() until the thread
+   runs.  Bucket 0 counts latencies under 1 us, bucket N those
+   from 2**(N-1) us up to 2**N us, and the last bucket everything
+   longer. */
+#define LATENCY_BUCKETS 20
+static long long wakeup_latency[LATENCY_BUCKETS];
+
+/* Statistics of the most recently exited threads, kept in a ring
+   so that they can still be reported at shutdown. */
+#define EXITED_STATS_CNT 32
+struct exited_stats
+  {
+    tid_t tid;                  /* Thread identifier. */
+    char name[16];              /* Thread name. */
+    struct thread_stats stats;  /* Its accounting at exit. */
+  };
+static struct exited_stats exited_stats[EXITED_STATS_CNT];
+static unsigned exited_cnt;     /* Total # of threads exited. */
+
+/* Pages of exited threads, kept for reuse by thread_create() so
+   that creating and destroying threads does not have to go
+   through the page allocator and its lock.  Each pooled page
+   begins with a pointer to the next one.  Accessed only with
+   interrupts off. */
+#define THREAD_POOL_MAX 16
+static void *thread_pool;
+static size_t thread_pool_cnt;
+static long long thread_pool_hits;      /* # of pages reused. */
+static long long thread_pool_misses;    /* # of pages allocated. */
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
@@ -60,16 +108,41 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Multi-level feedback queue scheduler state. */
+#define MLFQS_PRI_INTERVAL 4    /* Ticks between priority updates. */
+static fixed_point_t load_avg;  /* Estimated # of ready threads. */
+
+/* Threads whose recent_cpu has changed since their priority was
+   last computed.  Only these need their priority recomputed
+   every MLFQS_PRI_INTERVAL ticks, because recent_cpu otherwise
+   changes only once per second, when every priority is
+   recomputed anyway. */
+static struct list mlfqs_stale_list;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_queue_push (struct thread *);
+static void ready_queue_remove (struct thread *);
+static void thread_set_effective_priority (struct thread *, int priority);
+static void yield (bool preempted);
+static void account_switch (struct thread *cur, struct thread *next);
+static void print_thread_stats (struct thread *, void *aux);
+static void mlfqs_tick (struct thread *cur);
+static void mlfqs_update_second (int ready_threads);
+static void mlfqs_update_load_avg (int ready_threads);
+static void mlfqs_update_recent_cpu (struct thread *, void *aux);
+static void mlfqs_update_priority (struct thread *, void *aux);
+static int ready_max_priority (void);
 
 static void init_thread (struct thread *, const char *name, int priority);
 
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
+static struct thread *thread_page_get (void);
+static void thread_page_put (struct thread *);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
@@ -90,11 +163,15 @@ static tid_t allocate_tid (void);
 void
 thread_init (void)
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
+  list_init (&mlfqs_stale_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -141,6 +218,10 @@ thread_tick (void)
 #endif
   else
     kernel_ticks++;
+  t->stats.run_ticks++;
+
+  if (thread_mlfqs)
+    mlfqs_tick (t);
 
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
@@ -153,6 +234,88 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %lld sleeper wakeups avoided\n", avoided_wakeups);
+  printf ("Thread: %lld pages reused, %lld pages allocated\n",
+          thread_pool_hits, thread_pool_misses);
+
+  if (thread_report_stats)
+    {
+      enum intr_level old_level;
+      unsigned i, first;
+      int b;
+
+      printf ("Thread statistics:\n");
+      printf ("  %5s %-16s %10s %10s %8s %8s\n", "tid", "name",
+              "run ticks", "ready ms", "volunt", "involunt");
+      old_level = intr_disable ();
+      thread_foreach (print_thread_stats, NULL);
+      intr_set_level (old_level);
+
+      first = exited_cnt > EXITED_STATS_CNT ? exited_cnt - EXITED_STATS_CNT : 0;
+      if (first > 0)
+        printf ("  (%u earlier exited threads not shown)\n", first);
+      for (i = first; i < exited_cnt; i++)
+        {
+          const struct exited_stats *e = &exited_stats[i % EXITED_STATS_CNT];
+          printf ("  %5d %-16s %10lld %10lld %8u %8u (exited)\n",
+                  e->tid, e->name, e->stats.run_ticks,
+                  e->stats.ready_ns / 1000000,
+                  e->stats.voluntary_switches,
+                  e->stats.involuntary_switches);
+        }
+
+      printf ("Wakeup-to-run latency:\n");
+      for (b = 0; b < LATENCY_BUCKETS; b++)
+        if (wakeup_latency[b] != 0)
+          {
+            if (b == 0)
+              printf ("  %10s < %7d us: %lld\n", "", 1, wakeup_latency[b]);
+            else if (b == LATENCY_BUCKETS - 1)
+              printf ("  %10s >= %6d us: %lld\n", "",
+                      1 << (b - 1), wakeup_latency[b]);
+            else
+              printf ("  %7d us .. %7d us: %lld\n",
+                      1 << (b - 1), 1 << b, wakeup_latency[b]);
+          }
+    }
+}
+
+/* Prints one line of the per-thread statistics table for T. */
+static void
+print_thread_stats (struct thread *t, void *aux UNUSED)
+{
+  printf ("  %5d %-16s %10lld %10lld %8u %8u\n",
+          t->tid, t->name, t->stats.run_ticks, t->stats.ready_ns / 1000000,
+          t->stats.voluntary_switches, t->stats.involuntary_switches);
+}
+
+/* Accounts for CNT timer ticks, ending at tick NOW, that passed
+   while the idle thread ran with the periodic timer interrupt
+   stopped (see timer_idle_enter()).  No thread was ready in that
+   time, so the ticks were idle, and any once-per-second
+   multi-level feedback queue updates that fell in it are applied
+   with no ready threads.  Must be called with interrupts off. */
+void
+thread_idle_catch_up (int64_t now, int64_t cnt)
+{
+  int64_t tick;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  idle_ticks += cnt;
+  if (thread_mlfqs)
+    for (tick = now - cnt + 1; tick <= now; tick++)
+      if (tick % TIMER_FREQ == 0)
+        mlfqs_update_second (0);
+}
+
+/* Records that CNT sleeping threads stayed blocked through a
+   timer tick instead of being put back on the ready list.
+   Called by the timer interrupt handler. */
+void
+thread_count_avoided_wakeups (size_t cnt)
+{
+  avoided_wakeups += cnt;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -167,9 +330,12 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread has a higher priority than the running
+   thread, the running thread yields to it before this function
+   returns.  Under the multi-level feedback queue scheduler,
+   PRIORITY is ignored: the new thread inherits the running
+   thread's nice and recent_cpu values and its priority is
+   computed from them. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux)
@@ -183,7 +349,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = thread_page_get ();
   if (t == NULL)
     return TID_ERROR;
 
@@ -191,6 +357,18 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
 
+  /* Inherit scheduling inputs.  The idle thread keeps PRI_MIN. */
+  if (thread_mlfqs && function != idle)
+    {
+      struct thread *cur = thread_current ();
+      enum intr_level old_level = intr_disable ();
+
+      t->nice = cur->nice;
+      t->recent_cpu = cur->recent_cpu;
+      mlfqs_update_priority (t, NULL);
+      intr_set_level (old_level);
+    }
+
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
   kf->eip = NULL;
@@ -207,9 +385,9 @@ thread_create (const char *name, int priority,
   sf->ebp = 0;
 
   /* Add to run queue. */
-  thread_unblock (t);
   t->parent_thread = thread_current();
-
+  thread_unblock (t);
+  thread_yield_to_higher ();
 
   return tid;
 }
@@ -234,10 +412,11 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   This function does not preempt the running thread, even if T
+   has a higher priority.  This can be important: if the caller
+   had disabled interrupts itself, it may expect that it can
+   atomically unblock a thread and update other data.  Call
+   thread_yield_to_higher() afterward to give up the CPU. */
 void
 thread_unblock (struct thread *t)
 {
@@ -247,8 +426,11 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_queue_push (t);
   t->status = THREAD_READY;
+  t->ready_since = timer_ns ();
+  t->woken = true;
+  t->preempted = false;
   intr_set_level (old_level);
 }
 
@@ -295,12 +477,22 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  fpu_exit ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
   list_remove (&thread_current()->allelem);
+  if (thread_current ()->priority_stale)
+    list_remove (&thread_current ()->staleelem);
+  if (thread_report_stats)
+    {
+      struct exited_stats *e = &exited_stats[exited_cnt++ % EXITED_STATS_CNT];
+      e->tid = thread_current ()->tid;
+      strlcpy (e->name, thread_current ()->name, sizeof e->name);
+      e->stats = thread_current ()->stats;
+    }
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -310,6 +502,24 @@ thread_exit (void)
    may be scheduled again immediately at the scheduler's whim. */
 void
 thread_yield (void)
+{
+  yield (false);
+}
+
+/* Yields the CPU because the running thread is being preempted,
+   by the end of its time slice or by a higher-priority thread,
+   rather than giving it up on its own accord.  The two differ
+   only in how the switch is accounted. */
+void
+thread_preempt (void)
+{
+  yield (true);
+}
+
+/* Puts the running thread back on the run queue and schedules,
+   recording whether this was due to PREEMPTED. */
+static void
+yield (bool preempted)
 {
   struct thread *cur = thread_current ();
   enum intr_level old_level;
@@ -318,12 +528,40 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread)
-    list_push_back (&ready_list, &cur->elem);
+    ready_queue_push (cur);
   cur->status = THREAD_READY;
+  cur->ready_since = timer_ns ();
+  cur->woken = false;
+  cur->preempted = preempted;
   schedule ();
   intr_set_level (old_level);
 }
 
+/* Yields the CPU if some ready thread has a higher priority than
+   the running thread.  Within an external interrupt handler, the
+   yield is deferred until the handler returns. */
+void
+thread_yield_to_higher (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int max_priority;
+  bool preempt;
+
+  old_level = intr_disable ();
+  max_priority = ready_max_priority ();
+  preempt = (max_priority > cur->priority
+             || (cur == idle_thread && max_priority >= 0));
+  intr_set_level (old_level);
+
+  if (!preempt)
+    return;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else
+    thread_preempt ();
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -341,11 +579,90 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.  The
+   effective priority stays raised while other threads donate a
+   higher one.  Yields if the running thread no longer has the
+   highest priority.  Ignored under the multi-level feedback
+   queue scheduler, which computes priorities itself. */
 void
 thread_set_priority (int new_priority)
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_refresh_priority (cur);
+  intr_set_level (old_level);
+  thread_yield_to_higher ();
+}
+
+/* Raises thread T's effective priority to PRIORITY, if that is
+   higher than its current one, moving T to the matching run
+   queue if it is ready.  Must be called with interrupts off. */
+void
+thread_donate_priority (struct thread *t, int priority)
+{
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority > t->priority)
+    thread_set_effective_priority (t, priority);
+}
+
+/* Recomputes thread T's effective priority as the maximum of its
+   base priority and the priorities of the threads waiting for
+   the locks it holds.  Used when T releases a lock or changes
+   its base priority.  Must be called with interrupts off. */
+void
+thread_refresh_priority (struct thread *t)
+{
+  struct list_elem *l, *w;
+  int priority = t->base_priority;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (l = list_begin (&t->locks_held); l != list_end (&t->locks_held);
+       l = list_next (l))
+    {
+      struct lock *lock = list_entry (l, struct lock, elem);
+      struct list *waiters = &lock->semaphore.waiters;
+
+      for (w = list_begin (waiters); w != list_end (waiters);
+           w = list_next (w))
+        {
+          struct thread *waiter = list_entry (w, struct thread, elem);
+          if (waiter->priority > priority)
+            priority = waiter->priority;
+        }
+    }
+  thread_set_effective_priority (t, priority);
+}
+
+/* Sets thread T's effective priority to PRIORITY, moving T to
+   the matching run queue if it is ready. */
+static void
+thread_set_effective_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  if (t->priority == priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      ready_queue_remove (t);
+      t->priority = priority;
+      ready_queue_push (t);
+    }
+  else
+    t->priority = priority;
 }
 
 /* Returns the current thread's priority. */
@@ -355,35 +672,150 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority.  Yields if the running thread no longer has the
+   highest priority. */
 void
-thread_set_nice (int nice UNUSED)
+thread_set_nice (int nice)
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur, NULL);
+  intr_set_level (old_level);
+  thread_yield_to_higher ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load_avg_100 = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu_100 = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent_cpu_100;
+}
+
+/* Multi-level feedback queue scheduler work for one timer tick,
+   with CUR the running thread.  Charges the tick to CUR's
+   recent_cpu.  Once per second, updates the load average and
+   every thread's recent_cpu and priority.  Otherwise, every
+   MLFQS_PRI_INTERVAL ticks, recomputes the priority of just the
+   threads whose recent_cpu has changed since the last time. */
+static void
+mlfqs_tick (struct thread *cur)
+{
+  int64_t now = timer_ticks ();
+
+  if (cur != idle_thread)
+    {
+      cur->recent_cpu = fp_add_int (cur->recent_cpu, 1);
+      if (!cur->priority_stale)
+        {
+          cur->priority_stale = true;
+          list_push_back (&mlfqs_stale_list, &cur->staleelem);
+        }
+    }
+
+  if (now % TIMER_FREQ == 0)
+    mlfqs_update_second (ready_cnt + (cur != idle_thread));
+  else if (now % MLFQS_PRI_INTERVAL == 0)
+    {
+      while (!list_empty (&mlfqs_stale_list))
+        {
+          struct list_elem *e = list_front (&mlfqs_stale_list);
+          mlfqs_update_priority (list_entry (e, struct thread, staleelem),
+                                 NULL);
+        }
+    }
+  else
+    return;
+
+  thread_yield_to_higher ();
+}
+
+/* Once-per-second scheduler update, given READY_THREADS, the
+   number of threads running or ready to run: updates the load
+   average, then every thread's recent_cpu and priority. */
+static void
+mlfqs_update_second (int ready_threads)
+{
+  mlfqs_update_load_avg (ready_threads);
+  thread_foreach (mlfqs_update_recent_cpu, NULL);
+  thread_foreach (mlfqs_update_priority, NULL);
+}
+
+/* Updates the load average from READY_THREADS, the number of
+   threads that are running or ready to run:
+     load_avg = (59/60)*load_avg + (1/60)*ready_threads. */
+static void
+mlfqs_update_load_avg (int ready_threads)
+{
+  load_avg = (fp_mul (fp_div (fp_from_int (59), fp_from_int (60)), load_avg)
+              + fp_from_int (ready_threads) / 60);
+}
+
+/* Decays thread T's recent_cpu according to the load average:
+     recent_cpu = (2*load_avg)/(2*load_avg + 1)*recent_cpu + nice. */
+static void
+mlfqs_update_recent_cpu (struct thread *t, void *aux UNUSED)
+{
+  fixed_point_t coeff;
+
+  if (t == idle_thread)
+    return;
+  coeff = fp_div (2 * load_avg, fp_add_int (2 * load_avg, 1));
+  t->recent_cpu = fp_add_int (fp_mul (coeff, t->recent_cpu), t->nice);
+}
+
+/* Recomputes thread T's priority from its recent_cpu and nice:
+     priority = PRI_MAX - recent_cpu/4 - nice*2,
+   clamped to PRI_MIN...PRI_MAX, and takes T off
+   mlfqs_stale_list. */
+static void
+mlfqs_update_priority (struct thread *t, void *aux UNUSED)
+{
+  int priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->priority_stale)
+    {
+      list_remove (&t->staleelem);
+      t->priority_stale = false;
+    }
+  if (t == idle_thread)
+    return;
+
+  priority = PRI_MAX - fp_trunc (t->recent_cpu / 4) - t->nice * 2;
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->base_priority = priority;
+  thread_set_effective_priority (t, priority);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -408,6 +840,9 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Stop the periodic timer interrupt if nothing needs it. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -472,6 +907,8 @@ init_thread (struct thread *t, const char *name, int priority)
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
+  t->base_priority = priority;
+  list_init (&t->locks_held);
   t->magic = THREAD_MAGIC;
   t->parent_thread = 0; // Initalise parent thread
 
@@ -505,14 +942,72 @@ alloc_frame (struct thread *t, size_t size)
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   idle_thread.
+
+   The thread chosen is the one at the front of the nonempty run
+   queue with the highest priority, so threads of equal priority
+   are scheduled round-robin. */
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
+  int priority = ready_max_priority ();
+  struct list *queue;
+  struct thread *t;
+
+  if (priority < 0)
     return idle_thread;
+
+  queue = &ready_queues[priority - PRI_MIN];
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  if (list_empty (queue))
+    ready_mask &= ~((uint64_t) 1 << (priority - PRI_MIN));
+  ready_cnt--;
+  return t;
+}
+
+/* Appends T to the back of the run queue for its priority. */
+static void
+ready_queue_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_queues[t->priority - PRI_MIN], &t->elem);
+  ready_mask |= (uint64_t) 1 << (t->priority - PRI_MIN);
+  ready_cnt++;
+}
+
+/* Removes ready thread T from its run queue. */
+static void
+ready_queue_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority - PRI_MIN]))
+    ready_mask &= ~((uint64_t) 1 << (t->priority - PRI_MIN));
+  ready_cnt--;
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   -1 if no thread is ready.  Finds the most significant bit of
+   ready_mask one 32-bit half at a time, so that GCC does not
+   need a 64-bit helper from libgcc. */
+static int
+ready_max_priority (void)
+{
+  uint32_t high = ready_mask >> 32;
+  uint32_t low = ready_mask;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (high != 0)
+    return PRI_MIN + 63 - __builtin_clz (high);
+  else if (low != 0)
+    return PRI_MIN + 31 - __builtin_clz (low);
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    return -1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -544,6 +1039,9 @@ thread_schedule_tail (struct thread *prev)
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* Let the new thread reach its FPU state, if still loaded. */
+  fpu_switch (cur);
+
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate ();
@@ -557,7 +1055,7 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread)
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      thread_page_put (prev);
     }
 }
 
@@ -579,11 +1077,97 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  if (cur == idle_thread)
+    timer_idle_exit ();
+
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      account_switch (cur, next);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
+/* Updates scheduler statistics for a switch from CUR, which has
+   just stopped running, to NEXT, which is about to run: counts
+   the switch against CUR, charges NEXT for its time in the run
+   queue, and if NEXT was woken up, records its wakeup latency. */
+static void
+account_switch (struct thread *cur, struct thread *next)
+{
+  int64_t waited;
+
+  if (cur->status == THREAD_READY && cur->preempted)
+    cur->stats.involuntary_switches++;
+  else
+    cur->stats.voluntary_switches++;
+
+  if (next == idle_thread)
+    return;
+
+  waited = timer_ns () - next->ready_since;
+  next->stats.ready_ns += waited;
+  if (next->woken)
+    {
+      int64_t us = waited / 1000;
+      int bucket = 0;
+
+      while (us > 0 && bucket < LATENCY_BUCKETS - 1)
+        {
+          us >>= 1;
+          bucket++;
+        }
+      wakeup_latency[bucket]++;
+      next->woken = false;
+    }
+}
+
+/* Returns a page for a new thread, preferably one recycled from
+   an exited thread, or a null pointer if none is available.
+   Only the struct thread at the start of the page is zeroed, by
+   init_thread(); the stack above it needs no initialization. */
+static struct thread *
+thread_page_get (void)
+{
+  enum intr_level old_level;
+  void *page;
+
+  old_level = intr_disable ();
+  page = thread_pool;
+  if (page != NULL)
+    {
+      thread_pool = *(void **) page;
+      thread_pool_cnt--;
+      thread_pool_hits++;
+    }
+  intr_set_level (old_level);
+
+  if (page == NULL)
+    {
+      page = palloc_get_page (0);
+      if (page != NULL)
+        thread_pool_misses++;
+    }
+  return page;
+}
+
+/* Releases the page of dead thread T, keeping it for reuse if
+   the pool is not already full.  Called with interrupts off. */
+static void
+thread_page_put (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_pool_cnt < THREAD_POOL_MAX)
+    {
+      *(void **) t = thread_pool;
+      thread_pool = t;
+      thread_pool_cnt++;
+    }
+  else
+    palloc_free_page (t);
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void)
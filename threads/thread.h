@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/synch.h"
 
 /* States in a thread's life cycle. */
@@ -25,6 +26,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the multi-level feedback queue scheduler. */
+#define NICE_MIN -20                    /* Nicest to other threads. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -122,9 +128,19 @@ typedef int tid_t;
  struct file_info {
   int fd; //Descriptor ID for the file
   struct file *fp; //Pointer for the file
+  struct dir *dir; //Directory for readdir, if the file is one
   struct list_elem fpelem; //Used to reference list of files
  };
 
+/* Scheduler accounting for one thread. */
+struct thread_stats
+  {
+    int64_t run_ticks;                  /* Timer ticks spent running. */
+    int64_t ready_ns;                   /* Time spent ready to run. */
+    unsigned voluntary_switches;        /* Blocked or yielded. */
+    unsigned involuntary_switches;      /* Preempted. */
+  };
+
 /*
   Thread used by PintOS
 */
@@ -135,7 +151,19 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Effective priority. */
+    int base_priority;                  /* Priority before donation. */
+    struct list locks_held;             /* Locks this thread holds. */
+    struct lock *waiting_lock;          /* Lock this thread waits for. */
+    int nice;                           /* Niceness, for -mlfqs. */
+    fixed_point_t recent_cpu;           /* Recent CPU use, for -mlfqs. */
+    bool priority_stale;                /* On mlfqs_stale_list? */
+    struct list_elem staleelem;         /* mlfqs_stale_list element. */
+    struct thread_stats stats;          /* Scheduler accounting. */
+    int64_t ready_since;                /* timer_ns() when made ready. */
+    bool woken;                         /* Made ready by thread_unblock()? */
+    bool preempted;                     /* Made ready by preemption? */
+    void *fpu_area;                     /* FPU save area, if FPU used. */
     struct list_elem allelem;           /* List element for all threads list. */
 
 
@@ -145,6 +173,8 @@ struct thread
     struct list children;               /* Stores list of children processes */
     struct thread *parent_thread;       /* Stores parent thread */
     struct list files;                  /* Stores list of files */
+    struct dir *cwd;                    /* Working directory, null for root */
+    int journal_depth;                  /* Nesting of journal_begin() calls */
 
 
     /* Shared between thread.c and synch.c. */
@@ -165,11 +195,18 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, print per-thread scheduler statistics and the wakeup
+   latency histogram at shutdown.  Controlled by kernel
+   command-line action "threadstats". */
+extern bool thread_report_stats;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+void thread_count_avoided_wakeups (size_t cnt);
+void thread_idle_catch_up (int64_t now, int64_t cnt);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -183,6 +220,8 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
+void thread_yield_to_higher (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -190,6 +229,8 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *, int priority);
+void thread_refresh_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -92,10 +92,15 @@ start_process (void *file_name_)
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
 
+  //Inherit the working directory, which the parent keeps open
+  //while it waits for the load to finish
+  struct thread *p = child_thread->parent_thread;
+  if (p->cwd != NULL)
+    child_thread->cwd = dir_reopen (p->cwd);
+
   success = load (file_name, &if_.eip, &if_.esp);
 
   //Loops through parent child list
-  struct thread *p = child_thread->parent_thread;
   struct list_elem *e;
 
   //Sets load status successful if process found
@@ -191,6 +196,10 @@ process_exit (void)
   // Handles termination messaging
   printf("%s : exit(%d)\n", cur->name, cur->exit_code);
 
+  // Release the working directory
+  dir_close (cur->cwd);
+  cur->cwd = NULL;
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
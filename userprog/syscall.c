@@ -4,6 +4,8 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/init.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
 
 /* Function prototypes */
 static void syscall_handler (struct intr_frame *);
@@ -63,6 +65,17 @@ static int open_file(char *file_name)
     fd++;
   }
 
+  //Directories also get a handle for readdir
+  fi->dir = NULL;
+  if (inode_is_dir(file_get_inode(file))) {
+    fi->dir = dir_open(inode_reopen(file_get_inode(file)));
+    if (fi->dir == NULL) {
+      file_close(file);
+      free(fi);
+      return -1;
+    }
+  }
+
   //Return file information to struct
   fi->fd = fd;
   fi->fp = file;
@@ -200,6 +213,11 @@ syscall_handler (struct intr_frame *f UNUSED)
       if (fi == NULL){
         system_exit(-1);
       }
+      //Directories cannot be read as files
+      if (fi->dir != NULL) {
+        f->eax = -1;
+        break;
+      }
       //Read bytes from file and return byte count
       f->eax = file_read(fi->fp, buffer, file_size);
       break;
@@ -217,7 +235,10 @@ syscall_handler (struct intr_frame *f UNUSED)
       }
       else { //Get file to write to
         struct file_info *fi = get_file(fd);
-        if(fi != NULL) { //Returns number of bytes written
+        if(fi != NULL && fi->dir != NULL) { //Directories cannot be written
+          f->eax = -1;
+        }
+        else if(fi != NULL) { //Returns number of bytes written
           f->eax = file_write (fi->fp, buffer, file_length);
         }
         else { //If file doesnt exist then cannot write
@@ -259,11 +280,61 @@ syscall_handler (struct intr_frame *f UNUSED)
       //Closes file and removes it from list in struct
       fi = get_file(fd);
       if (fi != NULL) {
+        dir_close(fi->dir);
         file_close(fi->fp);
         list_remove(&fi->fpelem);
         free(fi);
       }
       break;
     }
+
+    case SYS_CHDIR:{
+      //Changes working directory, returns true if successful
+      f->eax = filesys_chdir(
+        (char *)fetch_args(f,ARG_1) //Directory name
+      );
+      break;
+    }
+
+    case SYS_MKDIR:{
+      //Creates directory, returns true if successful
+      f->eax = filesys_mkdir(
+        (char *)fetch_args(f,ARG_1) //Directory name
+      );
+      break;
+    }
+
+    case SYS_READDIR:{
+      //Reads next entry name of a directory, returns false at end
+      struct file_info *fi = get_file((int)fetch_args(f,ARG_1));
+      char *name = (char *)fetch_args(f,ARG_2);
+      if (fi != NULL && fi->dir != NULL) {
+        f->eax = dir_readdir(fi->dir, name);
+      }
+      else {
+        f->eax = false;
+      }
+      break;
+    }
+
+    case SYS_ISDIR:{
+      //Returns true if file descriptor refers to a directory
+      struct file_info *fi = get_file((int)fetch_args(f,ARG_1));
+      if (fi == NULL) {
+        system_exit(-1);
+      }
+      f->eax = fi->dir != NULL;
+      break;
+    }
+
+    case SYS_INUMBER:{
+      //Returns inode number (sector) of the file descriptor
+      struct file_info *fi = get_file((int)fetch_args(f,ARG_1));
+      if (fi == NULL) {
+        system_exit(-1);
+      }
+      f->eax = inode_get_inumber(file_get_inode(fi->fp));
+      break;
+    }
   }
 }